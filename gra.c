@@ -30,6 +30,7 @@
 
 #include "gra.h"
 #include "gz.h"
+#include "perf.h"
 #include "skin.h"
 
 
@@ -58,8 +59,8 @@ static void locate_sprite(SDL_Rect *r, unsigned short id, const struct spritesst
 }
 
 
-/* render a tiled background over the entire screen */
-void gra_renderbg(SDL_Renderer *renderer, struct spritesstruct *spr, unsigned short id, unsigned short tilesize, int winw, int winh) {
+/* fills the current render target with background tiles */
+static void renderbg_tiles(SDL_Renderer *renderer, struct spritesstruct *spr, unsigned short id, unsigned short tilesize, int winw, int winh) {
   SDL_Rect src, dst;
 
   /* prep src rect from sprite map */
@@ -73,17 +74,127 @@ void gra_renderbg(SDL_Renderer *renderer, struct spritesstruct *spr, unsigned sh
   /* fill screen with tiles */
   for (dst.y = 0; dst.y < winh; dst.y += dst.h) {
     for (dst.x = 0; dst.x < winw; dst.x += dst.w) {
+      perf_drawcall(spr->map);
       SDL_RenderCopy(renderer, spr->map, &src, &dst);
     }
   }
 }
 
 
-void gra_rendertile(SDL_Renderer *renderer, struct spritesstruct *spr, unsigned short id, int x, int y, unsigned short tilesize, int angle) {
+/* render a tiled background over the entire screen */
+void gra_renderbg(SDL_Renderer *renderer, struct spritesstruct *spr, unsigned short id, unsigned short tilesize, int winw, int winh) {
+
+  /* (re)compose the cached background if window size or zoom changed */
+  if ((spr->bg == NULL) || (spr->bgw != winw) || (spr->bgh != winh) || (spr->bgtilesize != tilesize) || (spr->bgid != id)) {
+    /* only the background itself is stale, the prescaled sprite map stays */
+    if (spr->bg != NULL) SDL_DestroyTexture(spr->bg);
+    spr->bg = NULL;
+    if (SDL_RenderTargetSupported(renderer) == SDL_TRUE) {
+      spr->bg = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_TARGET, winw, winh);
+    }
+    if (spr->bg != NULL) {
+      SDL_Texture *prevtarget = SDL_GetRenderTarget(renderer);
+      SDL_SetTextureBlendMode(spr->bg, SDL_BLENDMODE_NONE); /* the background is opaque */
+      SDL_SetRenderTarget(renderer, spr->bg);
+      SDL_RenderClear(renderer);
+      renderbg_tiles(renderer, spr, id, tilesize, winw, winh);
+      SDL_SetRenderTarget(renderer, prevtarget);
+      spr->bgw = winw;
+      spr->bgh = winh;
+      spr->bgtilesize = tilesize;
+      spr->bgid = id;
+    }
+  }
+
+  /* blit the cached background, or fall back to drawing tiles one by one */
+  if (spr->bg != NULL) {
+    perf_drawcall(spr->bg);
+    SDL_RenderCopy(renderer, spr->bg, NULL, NULL);
+  } else {
+    renderbg_tiles(renderer, spr, id, tilesize, winw, winh);
+  }
+}
+
+
+void gra_flushcache(struct spritesstruct *spr) {
+  if (spr->bg != NULL) SDL_DestroyTexture(spr->bg);
+  spr->bg = NULL;
+  if (spr->scaledmap != NULL) SDL_DestroyTexture(spr->scaledmap);
+  spr->scaledmap = NULL;
+  if (spr->scaledplayer != NULL) SDL_DestroyTexture(spr->scaledplayer);
+  spr->scaledplayer = NULL;
+  spr->scaledtilesize = 0;
+}
+
+
+/* returns a render target texture of w x h pixels, cleared to full transparency */
+static SDL_Texture *newtarget(SDL_Renderer *renderer, int w, int h) {
+  SDL_Texture *t;
+  Uint8 r, g, b, a;
+  t = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_TARGET, w, h);
+  if (t == NULL) return(NULL);
+  SDL_SetTextureBlendMode(t, SDL_BLENDMODE_BLEND);
+  SDL_SetRenderTarget(renderer, t);
+  SDL_GetRenderDrawColor(renderer, &r, &g, &b, &a);
+  SDL_SetRenderDrawColor(renderer, 0, 0, 0, 0);
+  SDL_RenderClear(renderer);
+  SDL_SetRenderDrawColor(renderer, r, g, b, a);
+  return(t);
+}
+
+
+void gra_prescale(SDL_Renderer *renderer, struct spritesstruct *spr, unsigned short tilesize) {
+  SDL_Texture *prevtarget;
   SDL_Rect src, dst;
+  int mapw, maph, rows, id, i;
+
+  if ((spr->scaledtilesize == tilesize) && (spr->scaledmap != NULL)) return;
+  /* drop the previous scaled map (the background cache may stay) */
+  if (spr->scaledmap != NULL) SDL_DestroyTexture(spr->scaledmap);
+  if (spr->scaledplayer != NULL) SDL_DestroyTexture(spr->scaledplayer);
+  spr->scaledmap = NULL;
+  spr->scaledplayer = NULL;
+  spr->scaledtilesize = 0;
+  /* nothing to gain at native size, and no way to do it without render targets */
+  if (tilesize == spr->tilesize) return;
+  if (SDL_RenderTargetSupported(renderer) != SDL_TRUE) return;
+  if (SDL_QueryTexture(spr->map, NULL, NULL, &mapw, &maph) != 0) return;
+  rows = (maph - 1) / (spr->tilesize + 1);
+
+  prevtarget = SDL_GetRenderTarget(renderer);
+  /* copy tiles one by one so the 1px gaps of the sprite map stay sharp. the
+   * map is copied without blending to keep its alpha channel untouched */
+  SDL_SetTextureBlendMode(spr->map, SDL_BLENDMODE_NONE);
+  spr->scaledmap = newtarget(renderer, 1 + 8 * (tilesize + 1), 1 + rows * (tilesize + 1));
+  if (spr->scaledmap != NULL) {
+    for (id = 0; id < rows * 8; id++) {
+      locate_sprite(&src, id, spr);
+      dst.x = 1 + (id % 8) * (tilesize + 1);
+      dst.y = 1 + (id / 8) * (tilesize + 1);
+      dst.w = tilesize;
+      dst.h = tilesize;
+      SDL_RenderCopy(renderer, spr->map, &src, &dst);
+    }
+    /* pre-rotated player frames: 90, 180 and 270 degrees, side by side */
+    spr->scaledplayer = newtarget(renderer, 1 + 3 * (tilesize + 1), tilesize + 2);
+    if (spr->scaledplayer != NULL) {
+      locate_sprite(&src, SPRITE_PLAYERROTATE, spr);
+      dst.y = 1;
+      for (i = 0; i < 3; i++) {
+        dst.x = 1 + i * (tilesize + 1);
+        SDL_RenderCopyEx(renderer, spr->map, &src, &dst, (i + 1) * 90, NULL, SDL_FLIP_NONE);
+      }
+    }
+    spr->scaledtilesize = tilesize;
+  }
+  SDL_SetTextureBlendMode(spr->map, SDL_BLENDMODE_BLEND);
+  SDL_SetRenderTarget(renderer, prevtarget);
+}
 
-  /* prep src rect from sprite map */
-  locate_sprite(&src, id, spr);
+
+void gra_rendertile(SDL_Renderer *renderer, struct spritesstruct *spr, unsigned short id, int x, int y, unsigned short tilesize, int angle) {
+  SDL_Rect src, dst;
+  SDL_Texture *map = spr->map;
 
   /* prep dst */
   dst.x = x;
@@ -91,9 +202,32 @@ void gra_rendertile(SDL_Renderer *renderer, struct spritesstruct *spr, unsigned
   dst.w = tilesize;
   dst.h = tilesize;
 
-  if ((angle == 0) || (id == SPRITE_PLAYERSTATIC)) {
-    SDL_RenderCopy(renderer, spr->map, &src, &dst);
+  if (id == SPRITE_PLAYERSTATIC) angle = 0;
+
+  /* use the pre-scaled sprite map if there is one for this tile size */
+  if ((tilesize == spr->scaledtilesize) && (spr->scaledmap != NULL)) {
+    src.w = tilesize;
+    src.h = tilesize;
+    if ((angle % 90 == 0) && (angle % 360 != 0) && (id == SPRITE_PLAYERROTATE) && (spr->scaledplayer != NULL)) {
+      /* right angles of the player come pre-rotated */
+      map = spr->scaledplayer;
+      src.x = 1 + (((angle / 90) % 4 + 3) % 4) * (tilesize + 1);
+      src.y = 1;
+      angle = 0;
+    } else {
+      map = spr->scaledmap;
+      src.x = 1 + (id % 8) * (tilesize + 1);
+      src.y = 1 + (id / 8) * (tilesize + 1);
+    }
+  } else {
+    /* prep src rect from sprite map */
+    locate_sprite(&src, id, spr);
+  }
+
+  perf_drawcall(map);
+  if (angle == 0) {
+    SDL_RenderCopy(renderer, map, &src, &dst);
   } else {
-    SDL_RenderCopyEx(renderer, spr->map, &src, &dst, angle, NULL, SDL_FLIP_NONE);
+    SDL_RenderCopyEx(renderer, map, &src, &dst, angle, NULL, SDL_FLIP_NONE);
   }
 }
@@ -30,8 +30,17 @@
 #include <SDL2/SDL.h>
 
 
+#define SPRITES_MAX 64 /* max number of tiles in a sprite map (8 per row) */
+
+/* what the pixels of a sprite map tile look like, computed once at skin load */
+struct spriteinfo {
+  unsigned char empty;   /* fully transparent */
+  unsigned char opaque;  /* no transparent (or translucent) pixel at all */
+  SDL_Rect bbox;         /* bounding box of visible pixels, relative to the tile */
+};
+
 struct spritesstruct {
-  SDL_Texture *bg;
+  SDL_Texture *bg;         /* pre-composited full-window background (cache) */
   SDL_Texture *black;
   SDL_Texture *cleared;
   SDL_Texture *nosolution;
@@ -49,15 +58,30 @@ struct spritesstruct {
   unsigned short tilesize; /* width (and height) of tiles present in the sprite map */
   unsigned short playerid; /* points either to SPRITES_PLAYERSTATIC or SPRITES_PLAYERROTATE */
   unsigned short em;       /* a font-related unit used to scale tiles and possibly other elements */
+  int bgw, bgh;            /* window size the cached background has been composed for */
+  unsigned short bgtilesize, bgid; /* tile size and sprite id of the cached background */
+  SDL_Texture *scaledmap;     /* sprite map rescaled to scaledtilesize (cache) */
+  SDL_Texture *scaledplayer;  /* rotate-player tile at scaledtilesize, turned by 90, 180 and 270 degrees (cache) */
+  unsigned short scaledtilesize; /* tile size of scaledmap, 0 if none */
+  unsigned short tilescount; /* number of tiles present in the sprite map */
+  struct spriteinfo tileinfo[SPRITES_MAX];
 };
 
 
 /* loads a gziped bmp image from memory and returns a surface */
 SDL_Surface *loadgzbmp(const unsigned char *memgz, size_t memgzlen);
 
-/* render a tiled background over the entire screen */
+/* render a tiled background over the entire screen. The background is
+ * composed once into a texture and only recomposed on resize or zoom. */
 void gra_renderbg(SDL_Renderer *renderer, struct spritesstruct *spr, unsigned short id, unsigned short tilesize, int winw, int winh);
 
+/* drops cached textures (must be called when the renderer lost its render targets) */
+void gra_flushcache(struct spritesstruct *spr);
+
+/* builds a copy of the sprite map rescaled to tilesize, so tiles drawn at
+ * this size are plain 1:1 copies. meant to be called once zoom settled. */
+void gra_prescale(SDL_Renderer *renderer, struct spritesstruct *spr, unsigned short tilesize);
+
 void gra_rendertile(SDL_Renderer *renderer, struct spritesstruct *spr, unsigned short id, int x, int y, unsigned short tilesize, int angle);
 
 #endif
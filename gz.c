@@ -106,3 +106,64 @@ void *ungz(const void *memgzsrc, size_t memgzlen, size_t *resultlen) {
   *resultlen = filelen;
   return(result);
 }
+
+
+struct gzstream {
+  z_stream zlibstream;
+  int finished;
+};
+
+
+struct gzstream *gzstream_new(void) {
+  struct gzstream *gz;
+  gz = calloc(1, sizeof(struct gzstream));
+  if (gz == NULL) return(NULL);
+  gz->zlibstream.zalloc = Z_NULL;
+  gz->zlibstream.zfree = Z_NULL;
+  gz->zlibstream.opaque = Z_NULL;
+  if (inflateInit2(&(gz->zlibstream), 31) != Z_OK) { /* 31 means "this is gzip data" */
+    free(gz);
+    return(NULL);
+  }
+  return(gz);
+}
+
+
+int gzstream_feed(struct gzstream *gz, const void *data, size_t len, gzstream_sink sink, void *ctx) {
+  unsigned char buff[16384];
+  size_t produced;
+  int res;
+
+  if (gz->finished != 0) return((len == 0) ? 0 : -1); /* no data is expected after the end of stream */
+  gz->zlibstream.next_in = (Bytef *)data; /* zlib does not modify input, see the note in ungz() */
+  gz->zlibstream.avail_in = (uInt)len;
+
+  /* inflate until all input is consumed and no output is pending */
+  do {
+    gz->zlibstream.next_out = buff;
+    gz->zlibstream.avail_out = sizeof(buff);
+    res = inflate(&(gz->zlibstream), Z_NO_FLUSH);
+    if (res == Z_STREAM_END) {
+      gz->finished = 1;
+    } else if ((res != Z_OK) && (res != Z_BUF_ERROR)) {
+      return(-1);
+    }
+    produced = sizeof(buff) - gz->zlibstream.avail_out;
+    if ((produced > 0) && (sink(ctx, buff, produced) != 0)) return(-1);
+    if ((res == Z_BUF_ERROR) && (produced == 0)) break; /* needs more input */
+  } while ((gz->finished == 0) && ((gz->zlibstream.avail_in > 0) || (gz->zlibstream.avail_out == 0)));
+
+  return(0);
+}
+
+
+int gzstream_finished(const struct gzstream *gz) {
+  return(gz->finished);
+}
+
+
+void gzstream_free(struct gzstream *gz) {
+  if (gz == NULL) return;
+  inflateEnd(&(gz->zlibstream));
+  free(gz);
+}
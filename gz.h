@@ -28,4 +28,21 @@
 #define gz_h_sentinel
   int isGz(const void *memgz, size_t memgzlen);
   void *ungz(const void *memgz, size_t memgzlen, size_t *resultlen);
+
+  /* streaming gzip decompression, for data that arrives piece by piece */
+  struct gzstream;
+
+  /* receives decompressed data, returns 0 on success (non-zero aborts) */
+  typedef int (*gzstream_sink)(void *ctx, const unsigned char *data, size_t len);
+
+  struct gzstream *gzstream_new(void);
+
+  /* decompresses len bytes of gzip data, passing every decompressed piece
+   * to sink. returns 0 on success, non-zero on corrupted data or sink error */
+  int gzstream_feed(struct gzstream *gz, const void *data, size_t len, gzstream_sink sink, void *ctx);
+
+  /* returns 1 if the end of the gzip stream has been reached, 0 otherwise */
+  int gzstream_finished(const struct gzstream *gz);
+
+  void gzstream_free(struct gzstream *gz);
 #endif
@@ -0,0 +1,382 @@
+/*
+ * on-disk cache of HTTP responses, revalidated with ETag / If-Modified-Since.
+ *
+ * Copyright (C) 2014-2023 Mateusz Viste
+ *
+ * MIT License
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <dirent.h>
+#include <stdio.h>    /* fopen(), rename(), remove() */
+#include <stdlib.h>   /* malloc(), free() */
+#include <string.h>   /* strcpy(), strcat() */
+#include <time.h>     /* time() */
+#include <sys/stat.h> /* mkdir(), stat() */
+#include <SDL2/SDL.h> /* SDL_GetPrefPath(), SDL_free() */
+
+#ifdef _WIN32
+#include <sys/utime.h>
+#define MKDIR(d) mkdir(d)
+#else
+#include <utime.h>
+#define MKDIR(d) mkdir(d, S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH)
+#endif
+
+#include "crc32.h"
+#include "net.h"
+
+#include "httpcache.h"
+
+#define HTTPCACHE_MAGIC "SIMPLESOK-HTTPCACHE 1"
+
+/* a cache entry, as loaded from disk */
+struct cacheentry {
+  char url[1024];
+  struct httpmeta meta;
+  unsigned char *body;
+  size_t bodylen;
+  long bodyoffset; /* where the body starts in the entry file */
+  time_t mtime;    /* last time the entry has been (re)validated, while atime is its last use */
+};
+
+
+/* fills cachedir with the directory where cached responses are kept, ends with a path separator */
+static void getcachedir(char *cachedir, int maxlen) {
+  char *prefpath;
+  if (maxlen > 0) cachedir[0] = 0;
+  maxlen -= 16; /* room for the "httpcache/" suffix and NULL terminator */
+  if (maxlen < 1) return;
+  prefpath = SDL_GetPrefPath("", "simplesok");
+  if (prefpath == NULL) return;
+  if (strlen(prefpath) > (unsigned)maxlen) {
+    SDL_free(prefpath);
+    return;
+  }
+  strcpy(cachedir, prefpath);
+  MKDIR(cachedir);
+  strcat(cachedir, "httpcache/");
+  MKDIR(cachedir);
+  SDL_free(prefpath);
+}
+
+
+/* computes the file name of the cache entry for url */
+static int getentryfile(char *fname, int maxlen, const char *url) {
+  unsigned long crc;
+  getcachedir(fname, maxlen - 16);
+  if (fname[0] == 0) return(-1);
+  crc = crc32_init();
+  crc32_feed(&crc, (const unsigned char *)url, (unsigned int)strlen(url));
+  crc32_finish(&crc);
+  sprintf(fname + strlen(fname), "%08lX.http", crc);
+  return(0);
+}
+
+
+/* reads a line from fd into buf, without its trailing newline */
+static int readfield(FILE *fd, char *buf, int maxlen) {
+  size_t len;
+  if (fgets(buf, maxlen, fd) == NULL) return(-1);
+  len = strlen(buf);
+  if ((len == 0) || (buf[len - 1] != '\n')) return(-1); /* too long */
+  buf[len - 1] = 0;
+  return(0);
+}
+
+
+/* loads the cache entry stored in fname, returns 0 on success. the body is
+ * loaded too if loadbody is set, which fails if it is over DATA_SIZE_LIMIT */
+static int entry_load(struct cacheentry *entry, const char *fname, const char *url, int loadbody) {
+  FILE *fd;
+  char buf[1024];
+  struct stat st;
+
+  memset(entry, 0, sizeof(*entry));
+  if (stat(fname, &st) != 0) return(-1);
+  entry->mtime = st.st_mtime;
+  fd = fopen(fname, "rb");
+  if (fd == NULL) return(-1);
+  if ((readfield(fd, buf, sizeof(buf)) != 0) || (strcmp(buf, HTTPCACHE_MAGIC) != 0)) goto FAIL;
+  if (readfield(fd, entry->url, sizeof(entry->url)) != 0) goto FAIL;
+  if (strcmp(entry->url, url) != 0) goto FAIL; /* crc collision */
+  if (readfield(fd, entry->meta.etag, sizeof(entry->meta.etag)) != 0) goto FAIL;
+  if (readfield(fd, entry->meta.lastmodified, sizeof(entry->meta.lastmodified)) != 0) goto FAIL;
+  if (readfield(fd, buf, sizeof(buf)) != 0) goto FAIL;
+  entry->bodylen = strtoul(buf, NULL, 10);
+  entry->bodyoffset = ftell(fd);
+  if (loadbody == 0) {
+    fclose(fd);
+    return(0);
+  }
+  if (entry->bodylen > DATA_SIZE_LIMIT) goto FAIL;
+  entry->body = malloc(entry->bodylen + 1);
+  if (entry->body == NULL) goto FAIL;
+  if (fread(entry->body, 1, entry->bodylen, fd) != entry->bodylen) goto FAIL;
+  entry->body[entry->bodylen] = 0; /* like http_get(), data is NULL-terminated */
+  fclose(fd);
+  return(0);
+
+  FAIL:
+  fclose(fd);
+  free(entry->body);
+  entry->body = NULL;
+  return(-1);
+}
+
+
+/* records a use of the entry stored in fname. the file's access time is
+ * the last use (what eviction goes by) and its modification time the last
+ * validation (what freshness goes by). both are set explicitly, so mount
+ * options like noatime do not matter */
+static void entry_touch(const char *fname, time_t validated) {
+  struct utimbuf times;
+  times.actime = time(NULL);
+  times.modtime = validated;
+  utime(fname, &times);
+}
+
+
+/* copies len bytes from src to dst, returns 0 on success */
+static int copybytes(FILE *dst, FILE *src, size_t len) {
+  unsigned char buf[16384];
+  size_t chunk;
+  while (len > 0) {
+    chunk = (len < sizeof(buf)) ? len : sizeof(buf);
+    if (fread(buf, 1, chunk, src) != chunk) return(-1);
+    if (fwrite(buf, 1, chunk, dst) != chunk) return(-1);
+    len -= chunk;
+  }
+  return(0);
+}
+
+
+/* copies the body of the cache entry stored in fname to dst, returns 0 on success */
+static int entry_copybody(const struct cacheentry *entry, const char *fname, FILE *dst) {
+  FILE *fd;
+  int err;
+  fd = fopen(fname, "rb");
+  if (fd == NULL) return(-1);
+  err = fseek(fd, entry->bodyoffset, SEEK_SET);
+  if (err == 0) err = copybytes(dst, fd, entry->bodylen);
+  fclose(fd);
+  return(err);
+}
+
+
+/* writes a new cache entry to fname, through a temporary file so readers
+ * never see a partial entry. the body comes from memory, or from the
+ * beginning of bodyfd if body is NULL */
+static void entry_save(const char *fname, const char *url, const struct httpmeta *meta, const unsigned char *body, FILE *bodyfd, size_t bodylen) {
+  char tmpname[1100];
+  FILE *fd;
+  int err;
+
+  sprintf(tmpname, "%.1000s.tmp", fname);
+  fd = fopen(tmpname, "wb");
+  if (fd == NULL) return;
+  fprintf(fd, "%s\n%s\n%s\n%s\n%lu\n", HTTPCACHE_MAGIC, url, meta->etag, meta->lastmodified, (unsigned long)bodylen);
+  if (body != NULL) {
+    err = (fwrite(body, 1, bodylen, fd) != bodylen);
+  } else {
+    rewind(bodyfd);
+    err = copybytes(fd, bodyfd, bodylen);
+  }
+  if (fclose(fd) != 0) err = 1;
+  if (err == 0) {
+    remove(fname); /* rename() does not overwrite on Windows */
+    if (rename(tmpname, fname) == 0) return;
+  }
+  remove(tmpname);
+}
+
+
+/* removes least recently used entries until the cache fits HTTPCACHE_MAXSIZE */
+static void cache_evict(void) {
+  struct cachefile {
+    char name[32];
+    long size;
+    time_t lastuse;
+  } *files = NULL, *newfiles;
+  int filescount = 0, filesalloc = 0, i, oldest;
+  long total = 0;
+  char dir[4096], fname[4200];
+  DIR *dirfd;
+  struct dirent *dentry;
+  struct stat st;
+
+  getcachedir(dir, sizeof(dir));
+  if (dir[0] == 0) return;
+  dirfd = opendir(dir);
+  if (dirfd == NULL) return;
+  while ((dentry = readdir(dirfd)) != NULL) {
+    size_t len = strlen(dentry->d_name);
+    if ((len < 6) || (len >= sizeof(files->name)) || (strcmp(dentry->d_name + len - 5, ".http") != 0)) continue;
+    sprintf(fname, "%s%s", dir, dentry->d_name);
+    if (stat(fname, &st) != 0) continue;
+    if (filescount == filesalloc) {
+      filesalloc = filesalloc * 2 + 16;
+      newfiles = realloc(files, sizeof(*files) * filesalloc);
+      if (newfiles == NULL) break;
+      files = newfiles;
+    }
+    strcpy(files[filescount].name, dentry->d_name);
+    files[filescount].size = (long)st.st_size;
+    files[filescount].lastuse = st.st_atime;
+    total += files[filescount].size;
+    filescount += 1;
+  }
+  closedir(dirfd);
+
+  while ((total > HTTPCACHE_MAXSIZE) && (filescount > 0)) {
+    oldest = 0;
+    for (i = 1; i < filescount; i++) {
+      if (files[i].lastuse < files[oldest].lastuse) oldest = i;
+    }
+    sprintf(fname, "%s%s", dir, files[oldest].name);
+    remove(fname);
+    total -= files[oldest].size;
+    files[oldest] = files[--filescount];
+  }
+  free(files);
+}
+
+
+size_t httpcache_get(const char *host, unsigned short port, const char *path, unsigned char **resptr, struct netprogress *progress) {
+  char url[1024], fname[4200];
+  struct cacheentry entry;
+  struct httpmeta meta;
+  int cached;
+  size_t reslen;
+
+  *resptr = NULL;
+  snprintf(url, sizeof(url), "http://%s:%u%s", host, port, path);
+  if (getentryfile(fname, sizeof(fname), url) != 0) return(http_request(host, port, path, resptr, progress, NULL));
+  cached = (entry_load(&entry, fname, url, 1) == 0);
+
+  /* a recently validated entry is used as-is */
+  if ((cached != 0) && (time(NULL) - entry.mtime < HTTPCACHE_FRESH)) {
+    entry_touch(fname, entry.mtime);
+    *resptr = entry.body;
+    return(entry.bodylen);
+  }
+
+  /* otherwise ask the server if what we have is still good */
+  memset(&meta, 0, sizeof(meta));
+  if (cached != 0) meta = entry.meta;
+  reslen = http_request(host, port, path, resptr, progress, &meta);
+
+  if ((cached != 0) && ((meta.status == 304) || ((meta.status == 0) && ((progress == NULL) || (SDL_AtomicGet(&(progress->cancel)) == 0))))) {
+    /* not modified, or server unreachable: serve the cached copy. only a
+     * successful revalidation makes the entry fresh again */
+    entry_touch(fname, (meta.status == 304) ? time(NULL) : entry.mtime);
+    if (meta.status == 0) printf("httpcache: %s unreachable, using a cached copy\n", host);
+    free(*resptr);
+    *resptr = entry.body;
+    return(entry.bodylen);
+  }
+  free(entry.body);
+
+  if ((meta.status == 200) && (*resptr != NULL)) {
+    entry_save(fname, url, &meta, *resptr, NULL, reslen);
+    cache_evict();
+  }
+  return(reslen);
+}
+
+
+/* serves the cache entry for httpcache_get_to_file(): in memory if it is
+ * small enough, copied to filename otherwise. returns its size, 0 on failure */
+static size_t entry_deliver(struct cacheentry *entry, const char *fname, const char *url, const char *filename, unsigned char **resptr) {
+  FILE *fd;
+  size_t len;
+  if (entry->bodylen <= DATA_SIZE_LIMIT) {
+    if (entry_load(entry, fname, url, 1) != 0) return(0);
+    *resptr = entry->body;
+    return(entry->bodylen);
+  }
+  fd = fopen(filename, "wb");
+  if (fd == NULL) return(0);
+  len = (entry_copybody(entry, fname, fd) == 0) ? entry->bodylen : 0;
+  if (fclose(fd) != 0) len = 0;
+  if (len == 0) remove(filename);
+  return(len);
+}
+
+
+size_t httpcache_get_to_file(const char *host, unsigned short port, const char *path, const char *filename, unsigned char **resptr, struct netprogress *progress) {
+  char url[1024], fname[4200], *tmpname;
+  struct cacheentry entry;
+  struct httpmeta meta;
+  int cached = 0;
+  size_t reslen = 0;
+  FILE *fd;
+
+  *resptr = NULL;
+  snprintf(url, sizeof(url), "http://%s:%u%s", host, port, path);
+  if (getentryfile(fname, sizeof(fname), url) == 0) cached = (entry_load(&entry, fname, url, 0) == 0);
+
+  /* a recently validated entry is used as-is */
+  if ((cached != 0) && (time(NULL) - entry.mtime < HTTPCACHE_FRESH)) {
+    reslen = entry_deliver(&entry, fname, url, filename, resptr);
+    if (reslen > 0) {
+      entry_touch(fname, entry.mtime);
+      return(reslen);
+    }
+    cached = 0;
+  }
+
+  /* otherwise stream the answer to a temporary file, renamed only once complete */
+  tmpname = malloc(strlen(filename) + 6);
+  if (tmpname == NULL) return(0);
+  sprintf(tmpname, "%s.part", filename);
+  fd = fopen(tmpname, "w+b");
+  if (fd == NULL) {
+    free(tmpname);
+    return(0);
+  }
+  memset(&meta, 0, sizeof(meta));
+  if (cached != 0) meta = entry.meta;
+  reslen = http_get_to_file(host, port, path, fd, progress, &meta);
+
+  if ((cached != 0) && ((meta.status == 304) || ((meta.status == 0) && ((progress == NULL) || (SDL_AtomicGet(&(progress->cancel)) == 0))))) {
+    /* not modified, or server unreachable: serve the cached copy */
+    fclose(fd);
+    remove(tmpname);
+    free(tmpname);
+    entry_touch(fname, (meta.status == 304) ? time(NULL) : entry.mtime);
+    if (meta.status == 0) printf("httpcache: %s unreachable, using a cached copy\n", host);
+    return(entry_deliver(&entry, fname, url, filename, resptr));
+  }
+
+  /* keep a copy of what fits in the cache */
+  if ((meta.status == 200) && (reslen > 0) && (fflush(fd) == 0) && (reslen <= (size_t)HTTPCACHE_MAXSIZE) && (fname[0] != 0)) {
+    entry_save(fname, url, &meta, NULL, fd, reslen);
+    cache_evict();
+  }
+  if (fclose(fd) != 0) reslen = 0;
+  remove(filename); /* rename() does not replace files on all systems */
+  if ((meta.status != 200) || (reslen == 0) || (rename(tmpname, filename) != 0)) {
+    remove(tmpname);
+    reslen = 0;
+  }
+  free(tmpname);
+  return(reslen);
+}
@@ -0,0 +1,49 @@
+/*
+ * on-disk cache of HTTP responses, revalidated with ETag / If-Modified-Since.
+ *
+ * Copyright (C) 2014-2023 Mateusz Viste
+ *
+ * MIT License
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef HTTPCACHE_H
+#define HTTPCACHE_H
+
+#include "net.h"
+
+#define HTTPCACHE_MAXSIZE (32L * 1024 * 1024) /* disk space the cache may use (bytes) */
+#define HTTPCACHE_FRESH 600 /* for how long (seconds) an entry is used without asking the server */
+
+/* same as http_request(), but goes through a response cache kept in the
+ * user's pref directory. fresh entries are served without any network
+ * access, older ones are revalidated with a conditional request, and stale
+ * copies are returned if the server cannot be reached at all. */
+size_t httpcache_get(const char *host, unsigned short port, const char *path, unsigned char **resptr, struct netprogress *progress);
+
+/* same as httpcache_get(), for resources that may be too large to be held
+ * in memory. a cached copy small enough is returned in *resptr like
+ * httpcache_get() does. otherwise *resptr is NULL and the body is written
+ * to filename: copied from the cache, or streamed from the server (through
+ * a temporary file, renamed once complete) and then kept in the cache if it
+ * fits. returns the size of the body, 0 on failure. */
+size_t httpcache_get_to_file(const char *host, unsigned short port, const char *path, const char *filename, unsigned char **resptr, struct netprogress *progress);
+
+#endif
@@ -0,0 +1,349 @@
+/*
+ * httpd is a minimal HTTP/1.1 server that serves a local directory, meant
+ * to test and benchmark Simple Sokoban's HTTP backends without internet.
+ * Copyright (C) Mateusz Viste 2014-2023
+ *
+ * it can simulate slow or broken servers: added latency, throttled
+ * bandwidth, chunked transfers, gzip encoding and injected errors. it is a
+ * POSIX-only test tool, one process per connection, not a real web server.
+ */
+
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>       /* strncasecmp() */
+#include <time.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>   /* TCP_NODELAY */
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <zlib.h>
+
+/* server configuration, set from the command line */
+static struct {
+  const char *root;
+  unsigned short port;
+  long latency;    /* ms to wait before answering each request */
+  long bandwidth;  /* max bytes per second sent (0 = unlimited) */
+  int chunked;     /* send bodies with "Transfer-Encoding: chunked" */
+  int gzip;        /* gzip bodies for clients that accept it */
+  int errors;      /* percentage of requests answered with a 500 error */
+  int verbose;
+} cfg;
+
+
+static long now_ms(void) {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return(tv.tv_sec * 1000L + tv.tv_usec / 1000);
+}
+
+
+/* sends len bytes, not faster than the configured bandwidth. start and sent
+ * keep track of what went out since the response began. returns 0 on success */
+static int sendthrottled(int sock, const unsigned char *data, size_t len, long start, long *sent) {
+  size_t blocklen = 4096;
+  long ahead;
+  ssize_t res;
+
+  if ((cfg.bandwidth > 0) && (cfg.bandwidth / 20 < (long)blocklen)) blocklen = cfg.bandwidth / 20 + 1;
+  while (len > 0) {
+    if (blocklen > len) blocklen = len;
+    res = send(sock, data, blocklen, 0);
+    if (res <= 0) return(-1);
+    data += res;
+    len -= (size_t)res;
+    *sent += res;
+    /* sleep off whatever was sent ahead of schedule */
+    if (cfg.bandwidth > 0) {
+      ahead = (*sent * 1000L) / cfg.bandwidth - (now_ms() - start);
+      if (ahead > 0) usleep((useconds_t)ahead * 1000);
+    }
+  }
+  return(0);
+}
+
+
+static int sendstr(int sock, const char *s) {
+  return((send(sock, s, strlen(s), 0) == (ssize_t)strlen(s)) ? 0 : -1);
+}
+
+
+/* compresses data into a newly allocated gzip stream, returns its length (0 on error) */
+static size_t gzipdata(const unsigned char *data, size_t len, unsigned char **out) {
+  z_stream z;
+  size_t outlen;
+
+  memset(&z, 0, sizeof(z));
+  if (deflateInit2(&z, 6, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) return(0);
+  outlen = deflateBound(&z, len);
+  *out = malloc(outlen);
+  if (*out == NULL) {
+    deflateEnd(&z);
+    return(0);
+  }
+  z.next_in = (unsigned char *)data;
+  z.avail_in = len;
+  z.next_out = *out;
+  z.avail_out = outlen;
+  if (deflate(&z, Z_FINISH) != Z_STREAM_END) {
+    free(*out);
+    deflateEnd(&z);
+    return(0);
+  }
+  outlen = z.total_out;
+  deflateEnd(&z);
+  return(outlen);
+}
+
+
+/* loads the whole file into memory, returns 0 on success */
+static int loadfile(const char *fname, unsigned char **data, size_t *len) {
+  FILE *fd;
+  struct stat st;
+
+  if ((stat(fname, &st) != 0) || (!S_ISREG(st.st_mode))) return(-1);
+  fd = fopen(fname, "rb");
+  if (fd == NULL) return(-1);
+  *len = (size_t)st.st_size;
+  *data = malloc(*len + 1);
+  if ((*data == NULL) || (fread(*data, 1, *len, fd) != *len)) {
+    free(*data);
+    fclose(fd);
+    return(-1);
+  }
+  fclose(fd);
+  return(0);
+}
+
+
+/* returns a pointer to the value of header name within the request head,
+ * copied into value (at most maxlen bytes), or NULL if not present */
+static char *getheader(const char *head, const char *name, char *value, size_t maxlen) {
+  const char *line;
+  size_t namelen = strlen(name), i;
+
+  for (line = strstr(head, "\r\n"); line != NULL; line = strstr(line, "\r\n")) {
+    line += 2;
+    if ((strncasecmp(line, name, namelen) != 0) || (line[namelen] != ':')) continue;
+    line += namelen + 1;
+    while (*line == ' ') line++;
+    for (i = 0; (i + 1 < maxlen) && (line[i] != '\r') && (line[i] != 0); i++) value[i] = line[i];
+    value[i] = 0;
+    return(value);
+  }
+  return(NULL);
+}
+
+
+/* answers one request, returns 0 if the connection may be kept open */
+static int handlerequest(int sock, const char *head) {
+  char method[8], path[1024], fname[2048], etag[64], value[256], hdr[512];
+  unsigned char *body = NULL, *gzbody = NULL;
+  size_t bodylen = 0;
+  struct stat st;
+  int status = 200, keepalive = 1, head_only, usegzip = 0;
+  long start, sent = 0;
+
+  if ((sscanf(head, "%7s %1023s", method, path) != 2) || (strncmp(strchr(head, ' ') + 1 + strlen(path), " HTTP/1.", 8) != 0)) {
+    sendstr(sock, "HTTP/1.1 400 Bad Request\r\nContent-Length: 0\r\nConnection: close\r\n\r\n");
+    return(-1);
+  }
+  if (strstr(head, " HTTP/1.0\r\n") != NULL) keepalive = 0;
+  if ((getheader(head, "Connection", value, sizeof(value)) != NULL) && (strncasecmp(value, "close", 5) == 0)) keepalive = 0;
+  head_only = (strcmp(method, "HEAD") == 0);
+  if (cfg.latency > 0) usleep((useconds_t)cfg.latency * 1000);
+
+  /* map the path to a file, directories are served through their "index" file */
+  if (strchr(path, '?') != NULL) *strchr(path, '?') = 0;
+  sprintf(fname, "%s%s%s", cfg.root, path, ((path[0] != 0) && (path[strlen(path) - 1] == '/')) ? "index" : "");
+  if ((strcmp(method, "GET") != 0) && (head_only == 0)) {
+    status = 405;
+  } else if ((path[0] != '/') || (strstr(path, "..") != NULL)) {
+    status = 403;
+  } else if ((cfg.errors > 0) && (rand() % 100 < cfg.errors)) {
+    status = 500;
+  } else if ((stat(fname, &st) != 0) || (loadfile(fname, &body, &bodylen) != 0)) {
+    status = 404;
+  } else {
+    sprintf(etag, "\"%lx-%lx\"", (unsigned long)st.st_size, (unsigned long)st.st_mtime);
+    if ((getheader(head, "If-None-Match", value, sizeof(value)) != NULL) && (strcmp(value, etag) == 0)) status = 304;
+  }
+  if (cfg.verbose) printf("[%d] %s %s %d\n", (int)getpid(), method, path, status);
+
+  if (status != 200) {
+    const char *reason = "Not Modified";
+    if (status == 403) reason = "Forbidden";
+    if (status == 404) reason = "Not Found";
+    if (status == 405) reason = "Method Not Allowed";
+    if (status == 500) reason = "Internal Server Error";
+    if (status == 304) {
+      sprintf(hdr, "HTTP/1.1 304 %s\r\nETag: %s\r\n\r\n", reason, etag);
+    } else {
+      sprintf(hdr, "HTTP/1.1 %d %s\r\nContent-Length: %d\r\n\r\n%s", status, reason, (int)strlen(reason), reason);
+    }
+    free(body);
+    if ((sendstr(sock, hdr) != 0) || (keepalive == 0)) return(-1);
+    return(0);
+  }
+
+  /* compress the body if the client accepts it */
+  if ((cfg.gzip != 0) && (getheader(head, "Accept-Encoding", value, sizeof(value)) != NULL) && (strstr(value, "gzip") != NULL)) {
+    size_t gzlen = gzipdata(body, bodylen, &gzbody);
+    if (gzlen > 0) {
+      free(body);
+      body = gzbody;
+      bodylen = gzlen;
+      usegzip = 1;
+    }
+  }
+
+  sprintf(hdr, "HTTP/1.1 200 OK\r\nETag: %s\r\n%s%s", etag, usegzip ? "Content-Encoding: gzip\r\n" : "", keepalive ? "" : "Connection: close\r\n");
+  if (cfg.chunked) {
+    strcat(hdr, "Transfer-Encoding: chunked\r\n\r\n");
+  } else {
+    sprintf(hdr + strlen(hdr), "Content-Length: %lu\r\n\r\n", (unsigned long)bodylen);
+  }
+  start = now_ms();
+  if (sendstr(sock, hdr) != 0) keepalive = 0;
+  if ((head_only == 0) && (cfg.chunked == 0)) {
+    if (sendthrottled(sock, body, bodylen, start, &sent) != 0) keepalive = 0;
+  } else if ((head_only == 0) && (cfg.chunked != 0)) {
+    size_t off, chunklen;
+    char chunkhdr[16];
+    for (off = 0; off < bodylen; off += chunklen) {
+      chunklen = bodylen - off;
+      if (chunklen > 8192) chunklen = 8192;
+      sprintf(chunkhdr, "%lx\r\n", (unsigned long)chunklen);
+      if ((sendstr(sock, chunkhdr) != 0) || (sendthrottled(sock, body + off, chunklen, start, &sent) != 0) || (sendstr(sock, "\r\n") != 0)) {
+        keepalive = 0;
+        break;
+      }
+    }
+    if (sendstr(sock, "0\r\n\r\n") != 0) keepalive = 0;
+  }
+  free(body);
+  return(keepalive ? 0 : -1);
+}
+
+
+/* serves requests over a connection until the client or an error closes it */
+static void serveconnection(int sock) {
+  char buf[8192];
+  size_t len = 0;
+  ssize_t res;
+  char *end;
+  int one = 1;
+
+  setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  srand((unsigned int)(time(NULL) ^ getpid()));
+  for (;;) {
+    /* read until the end of the request head */
+    buf[len] = 0;
+    while ((end = strstr(buf, "\r\n\r\n")) == NULL) {
+      if (len + 1 >= sizeof(buf)) return;
+      res = recv(sock, buf + len, sizeof(buf) - 1 - len, 0);
+      if (res <= 0) return;
+      len += (size_t)res;
+      buf[len] = 0;
+    }
+    end[2] = 0; /* keep the last header's CRLF */
+    if (handlerequest(sock, buf) != 0) return;
+    /* request bodies are not supported, so what follows is the next request */
+    end += 4;
+    len -= (size_t)(end - buf);
+    memmove(buf, end, len);
+  }
+}
+
+
+static void help(void) {
+  puts("httpd serves a directory over HTTP, to test Simple Sokoban offline.");
+  puts("");
+  puts("usage: httpd [options] dir");
+  puts("");
+  puts("options:");
+  puts("  -p port    port to listen on, on 127.0.0.1 (default: 8080)");
+  puts("  -l ms      latency added before answering each request");
+  puts("  -b bytes   bandwidth limit, in bytes per second");
+  puts("  -c         send bodies using chunked transfer encoding");
+  puts("  -z         gzip bodies for clients that accept it");
+  puts("  -e pct     answer pct% of requests with a 500 error");
+  puts("  -v         log requests");
+  puts("");
+  puts("Requests to a directory are answered with its \"index\" file.");
+}
+
+
+int main(int argc, char **argv) {
+  struct sockaddr_in addr;
+  int lsock, sock, i, one = 1;
+
+  cfg.port = 8080;
+  for (i = 1; i < argc; i++) {
+    if ((strcmp(argv[i], "-p") == 0) && (i + 1 < argc)) {
+      cfg.port = (unsigned short)atoi(argv[++i]);
+    } else if ((strcmp(argv[i], "-l") == 0) && (i + 1 < argc)) {
+      cfg.latency = atol(argv[++i]);
+    } else if ((strcmp(argv[i], "-b") == 0) && (i + 1 < argc)) {
+      cfg.bandwidth = atol(argv[++i]);
+    } else if ((strcmp(argv[i], "-e") == 0) && (i + 1 < argc)) {
+      cfg.errors = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "-c") == 0) {
+      cfg.chunked = 1;
+    } else if (strcmp(argv[i], "-z") == 0) {
+      cfg.gzip = 1;
+    } else if (strcmp(argv[i], "-v") == 0) {
+      cfg.verbose = 1;
+    } else if ((argv[i][0] != '-') && (cfg.root == NULL)) {
+      cfg.root = argv[i];
+    } else {
+      help();
+      return(1);
+    }
+  }
+  if (cfg.root == NULL) {
+    help();
+    return(1);
+  }
+
+  lsock = socket(AF_INET, SOCK_STREAM, 0);
+  if (lsock < 0) {
+    perror("socket");
+    return(2);
+  }
+  setsockopt(lsock, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(cfg.port);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if ((bind(lsock, (struct sockaddr *)&addr, sizeof(addr)) != 0) || (listen(lsock, 64) != 0)) {
+    perror("bind");
+    return(2);
+  }
+  signal(SIGCHLD, SIG_IGN); /* no zombies */
+  signal(SIGPIPE, SIG_IGN);
+  printf("serving %s on http://127.0.0.1:%u/\n", cfg.root, cfg.port);
+  fflush(stdout);
+
+  for (;;) {
+    sock = accept(lsock, NULL, NULL);
+    if (sock < 0) {
+      if (errno == EINTR) continue;
+      perror("accept");
+      return(3);
+    }
+    if (fork() == 0) {
+      close(lsock);
+      serveconnection(sock);
+      close(sock);
+      _exit(0);
+    }
+    close(sock);
+  }
+}
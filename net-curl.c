@@ -35,6 +35,7 @@
 
 #include <curl/curl.h>  /* cURL */
 
+#include "gz.h"
 #include "net.h"
 
 /* Network data loading control structure. */
@@ -42,6 +43,10 @@ struct netload {
   unsigned char *buffer;        /* Loaded data buffer. */
   size_t bufalloc;              /* Buffer size. */
   size_t datalen;               /* Data byte count in buffer. */
+  struct gzstream *gz;          /* Inflater if data is gzip-encoded. */
+  struct httpmeta *meta;        /* Response metadata, may be NULL. */
+  struct netprogress *progress; /* Transfer state, may be NULL. */
+  FILE *file;                   /* If set, data goes there instead. */
 };
 
 
@@ -55,92 +60,354 @@ void cleanup_net(void) {
 }
 
 
-/* Accumulate incoming data. */
-static size_t loaddata(void *ptr, size_t size, size_t nmemb, void *userdata) {
+/* Accumulate (decompressed) data. */
+static int appenddata(void *userdata, const unsigned char *data, size_t len) {
   struct netload *p = userdata;
 
-  (void) size;
+  /* Check the caller's size limit, if any. */
+  if (p->progress && SDL_AtomicGet(&p->progress->limit) > 0 &&
+      p->datalen + len > (size_t) SDL_AtomicGet(&p->progress->limit))
+    return -1;                  /* Error: over the caller's limit. */
+
+  /* Stream to file: no further size limit. */
+  if (p->file) {
+    if (fwrite(data, 1, len, p->file) != len)
+      return -1;
+    p->datalen += len;
+    return 0;
+  }
 
   /* Check size limit. */
-  if (p->datalen + nmemb > DATA_SIZE_LIMIT)
-    return (size_t) -1; /* Error: too many data bytes. */
+  if (p->datalen + len > DATA_SIZE_LIMIT)
+    return -1;                  /* Error: too many data bytes. */
 
   /* Enlarge buffer if needed. */
-  while (p->bufalloc < p->datalen + nmemb + 1) {
+  while (p->bufalloc < p->datalen + len + 1) {
     unsigned char *newbuf = realloc(p->buffer, p->bufalloc *= 2);
 
     if (!newbuf)
-      return (size_t) -1;       /* Error: can't allocate memory. */
+      return -1;                /* Error: can't allocate memory. */
     p->buffer = newbuf;
   }
 
   /* Append new data into buffer. */
-  memcpy(p->buffer + p->datalen, ptr, nmemb);
-  p->datalen += nmemb;
+  memcpy(p->buffer + p->datalen, data, len);
+  p->datalen += len;
   p->buffer[p->datalen] = '\0';
-  return nmemb;
+  return 0;
+}
+
+/* Incoming data: inflate it on the fly if it is gzip-encoded. */
+static size_t loaddata(void *ptr, size_t size, size_t nmemb, void *userdata) {
+  struct netload *p = userdata;
+  int err;
+
+  (void) size;
+
+  if (p->gz)
+    err = gzstream_feed(p->gz, ptr, nmemb, appenddata, p);
+  else
+    err = appenddata(p, ptr, nmemb);
+  return err? (size_t) -1: nmemb;
+}
+
+/* Report transfer progress, abort the transfer if cancellation was requested
+   or if the announced size is over the limit. */
+static int xferinfo(void *userdata, curl_off_t dltotal, curl_off_t dlnow, curl_off_t ultotal, curl_off_t ulnow) {
+  struct netprogress *p = userdata;
+  int limit = SDL_AtomicGet(&p->limit);
+
+  (void) ultotal;
+  (void) ulnow;
+
+  SDL_AtomicSet(&p->total, (int) dltotal);
+  SDL_AtomicSet(&p->received, (int) dlnow);
+  if (limit > 0 && dltotal > limit)
+    return 1;
+  return SDL_AtomicGet(&p->cancel) != 0;        /* Non-zero aborts. */
 }
 
 /* fetch a resource from host/path on defined port using http and return a pointer to the allocated chunk of memory
  * Note: do not forget to free the memory afterwards! */
 size_t http_get(const char *host, unsigned short port, const char *path, unsigned char **resptr) {
-  CURLU *url = curl_url();
-  CURL *easy = NULL;
+  return(http_request(host, port, path, resptr, NULL, NULL));
+}
+
+/* Pick validators and content encoding out of response headers. */
+static size_t loadheader(char *ptr, size_t size, size_t nmemb, void *userdata) {
+  struct netload *p = userdata;
+  struct httpmeta *meta = p->meta;
+  char *field = NULL;
+  size_t fieldlen = 0, len;
+
+  (void) size;
+
+  if (nmemb > 5 && !strncmp(ptr, "HTTP/", 5)) {
+    /* New response (redirects have several): forget previous ones. */
+    if (meta) {
+      meta->etag[0] = '\0';
+      meta->lastmodified[0] = '\0';
+    }
+    gzstream_free(p->gz);
+    p->gz = NULL;
+  }
+  else if (nmemb > 17 && curl_strnequal(ptr, "Content-Encoding:", 17)) {
+    /* Header data is not null-terminated. */
+    char value[64];
+
+    len = nmemb - 17 < sizeof(value) - 1? nmemb - 17: sizeof(value) - 1;
+    memcpy(value, ptr + 17, len);
+    value[len] = '\0';
+    /* We only ever ask for gzip. */
+    if (!p->gz && strstr(value, "gzip") && !(p->gz = gzstream_new()))
+      return (size_t) -1;
+  }
+  else if (meta && nmemb > 5 && curl_strnequal(ptr, "ETag:", 5)) {
+    field = meta->etag;
+    fieldlen = sizeof(meta->etag);
+    ptr += 5, len = nmemb - 5;
+  }
+  else if (meta && nmemb > 14 && curl_strnequal(ptr, "Last-Modified:", 14)) {
+    field = meta->lastmodified;
+    fieldlen = sizeof(meta->lastmodified);
+    ptr += 14, len = nmemb - 14;
+  }
+  if (field) {
+    /* Trim blanks and the trailing CRLF. */
+    while (len && *ptr == ' ')
+      ptr++, len--;
+    while (len && (ptr[len - 1] == '\r' || ptr[len - 1] == '\n' || ptr[len - 1] == ' '))
+      len--;
+    if (len >= fieldlen)
+      len = fieldlen - 1;
+    memcpy(field, ptr, len);
+    field[len] = '\0';
+  }
+  return nmemb;
+}
+
+/* One transfer: easy handle, its data and what must be freed with it. */
+struct transfer {
+  CURL *easy;
   struct netload ctrl;
+  struct curl_slist *headers;
+  char *urlstring;
+  int idx;                      /* Caller's index (http_get_multi()). */
+};
+
+
+/* Prepare a transfer of host/path. Returns 0 on success. */
+static int transfer_setup(struct transfer *t, const char *host, unsigned short port, const char *path, struct netprogress *progress, struct httpmeta *meta) {
+  CURLU *url = curl_url();
   char portstring[6];
-  char *urlstring = NULL;
-
-  ctrl.datalen = 0;
-  ctrl.bufalloc = 1024;
-  ctrl.buffer = NULL;
-  if(url) {
-    /* Build URL. */
-    snprintf(portstring, sizeof(portstring), "%hu", port);
-    if (!curl_url_set(url, CURLUPART_SCHEME, "http", 0) &&
-        !curl_url_set(url, CURLUPART_HOST, host, 0) &&
-        !curl_url_set(url, CURLUPART_PORT, portstring, 0) &&
-        !curl_url_set(url, CURLUPART_PATH, path, 0)) {
-      curl_url_get(url, CURLUPART_URL, &urlstring, CURLU_URLENCODE);
-
-      /* Build curl handle. */
-      if (urlstring && (easy = curl_easy_init())) {
-        curl_easy_setopt(easy, CURLOPT_URL, urlstring);
-        curl_easy_setopt(easy, CURLOPT_FOLLOWLOCATION, 1L);
-        curl_easy_setopt(easy, CURLOPT_WRITEFUNCTION, loaddata);
-        curl_easy_setopt(easy, CURLOPT_WRITEDATA, &ctrl);
+  char condheader[160];
+
+  memset(t, 0, sizeof(*t));
+  t->ctrl.bufalloc = 1024;
+  t->ctrl.meta = meta;
+  t->ctrl.progress = progress;
+  if (meta)
+    meta->status = 0;
+  if (!url)
+    return -1;
+
+  /* Build URL. */
+  snprintf(portstring, sizeof(portstring), "%hu", port);
+  if (!curl_url_set(url, CURLUPART_SCHEME, "http", 0) &&
+      !curl_url_set(url, CURLUPART_HOST, host, 0) &&
+      !curl_url_set(url, CURLUPART_PORT, portstring, 0) &&
+      !curl_url_set(url, CURLUPART_PATH, path, 0))
+    curl_url_get(url, CURLUPART_URL, &t->urlstring, CURLU_URLENCODE);
+  curl_url_cleanup(url);
+
+  /* Build curl handle and initial buffer. */
+  if (!t->urlstring || !(t->easy = curl_easy_init()) ||
+      !(t->ctrl.buffer = malloc(t->ctrl.bufalloc)))
+    return -1;
+  t->ctrl.buffer[0] = '\0';
+
+  curl_easy_setopt(t->easy, CURLOPT_URL, t->urlstring);
+  curl_easy_setopt(t->easy, CURLOPT_FOLLOWLOCATION, 1L);
+  curl_easy_setopt(t->easy, CURLOPT_WRITEFUNCTION, loaddata);
+  curl_easy_setopt(t->easy, CURLOPT_WRITEDATA, &t->ctrl);
+  curl_easy_setopt(t->easy, CURLOPT_PRIVATE, t);
+  /* Ask for gzip, and inflate it ourselves as it arrives (setting
+     CURLOPT_ACCEPT_ENCODING would make libcurl do it instead). */
+  t->headers = curl_slist_append(t->headers, "Accept-Encoding: gzip");
+  if (meta) {
+    if (meta->etag[0]) {
+      snprintf(condheader, sizeof(condheader), "If-None-Match: %s", meta->etag);
+      t->headers = curl_slist_append(t->headers, condheader);
+    }
+    if (meta->lastmodified[0]) {
+      snprintf(condheader, sizeof(condheader), "If-Modified-Since: %s", meta->lastmodified);
+      t->headers = curl_slist_append(t->headers, condheader);
+    }
+  }
+  curl_easy_setopt(t->easy, CURLOPT_HTTPHEADER, t->headers);
+  curl_easy_setopt(t->easy, CURLOPT_HEADERFUNCTION, loadheader);
+  curl_easy_setopt(t->easy, CURLOPT_HEADERDATA, &t->ctrl);
+  if (progress) {
+    curl_easy_setopt(t->easy, CURLOPT_NOPROGRESS, 0L);
+    curl_easy_setopt(t->easy, CURLOPT_XFERINFOFUNCTION, xferinfo);
+    curl_easy_setopt(t->easy, CURLOPT_XFERINFODATA, progress);
+  }
 #if defined(_WIN32) || defined(WIN32)
-        /* The request may be redirected to https and Windows libcurl packages
-           come without trusted CA bundle: if possible, use Windows trusted CA
-           certificate store for peer verification, else do not verify peer. */
+  /* The request may be redirected to https and Windows libcurl packages
+     come without trusted CA bundle: if possible, use Windows trusted CA
+     certificate store for peer verification, else do not verify peer. */
 # ifdef CURLSSLOPT_NATIVE_CA
-        /* Supported since 7.71.0. */
-        if (curl_version_info(CURLVERSION_NOW)->version_num >= 0x074700)
-          curl_easy_setopt(easy, CURLOPT_SSL_OPTIONS,
-                           (long) CURLSSLOPT_NATIVE_CA);
-        else
+  /* Supported since 7.71.0. */
+  if (curl_version_info(CURLVERSION_NOW)->version_num >= 0x074700)
+    curl_easy_setopt(t->easy, CURLOPT_SSL_OPTIONS,
+                     (long) CURLSSLOPT_NATIVE_CA);
+  else
 # endif
-        curl_easy_setopt(easy, CURLOPT_SSL_VERIFYPEER, 0L);
+  curl_easy_setopt(t->easy, CURLOPT_SSL_VERIFYPEER, 0L);
 #endif
+  return 0;
+}
+
+
+/* Conclude a transfer given its result code: release everything and hand
+   out the data (NULL unless a complete "200 OK" response was received). */
+static size_t transfer_finish(struct transfer *t, CURLcode result, const char *path, unsigned char **resptr) {
+  size_t datalen = 0;
+
+  *resptr = NULL;
+  if (t->easy && t->ctrl.buffer && result == CURLE_OK) {
+    long status = 0;
+
+    curl_easy_getinfo(t->easy, CURLINFO_RESPONSE_CODE, &status);
+    if (t->ctrl.meta)
+      t->ctrl.meta->status = (int) status;
+    if (status == 200 && t->ctrl.gz && !gzstream_finished(t->ctrl.gz))
+      printf("truncated gzip data for %s\n", path);
+    else if (status == 200) {
+      *resptr = t->ctrl.buffer;
+      datalen = t->ctrl.datalen;
+      t->ctrl.buffer = NULL;
+    }
+    /* Error pages (or "not modified" answers) are no level data. */
+    else if (status != 304)
+      printf("http error %ld for %s\n", status, path);
+  }
+
+  /* Clean up. */
+  curl_easy_cleanup(t->easy);
+  curl_slist_free_all(t->headers);
+  gzstream_free(t->ctrl.gz);
+  curl_free(t->urlstring);
+  free(t->ctrl.buffer);
+  memset(t, 0, sizeof(*t));
+  return datalen;
+}
+
+
+/* same as http_get(), reporting progress, watching for cancellation and
+ * handling conditional requests */
+size_t http_request(const char *host, unsigned short port, const char *path, unsigned char **resptr, struct netprogress *progress, struct httpmeta *meta) {
+  struct transfer t;
+  CURLcode result = (CURLcode) -1;
 
-        /* Allocate initial buffer and transfer data. */
-        if ((ctrl.buffer = malloc(ctrl.bufalloc))) {
-          ctrl.buffer[0] = '\0';
-          if (curl_easy_perform(easy)) {
-            /* An error occurred. */
-            free(ctrl.buffer);
-            ctrl.buffer = NULL;
-            ctrl.datalen = 0;
-          }
-        }
+  if (!transfer_setup(&t, host, port, path, progress, meta))
+    result = curl_easy_perform(t.easy);
+  return(transfer_finish(&t, result, path, resptr));
+}
+
+
+/* stream a resource to a file as it arrives */
+size_t http_get_to_file(const char *host, unsigned short port, const char *path, FILE *fd, struct netprogress *progress, struct httpmeta *meta) {
+  struct transfer t;
+  CURLcode result = (CURLcode) -1;
+  unsigned char *res;
+  size_t datalen;
+
+  if (!transfer_setup(&t, host, port, path, progress, meta)) {
+    t.ctrl.file = fd;
+    result = curl_easy_perform(t.easy);
+  }
+  datalen = transfer_finish(&t, result, path, &res);
+  if (!res)
+    return 0;
+  free(res);                    /* Unused memory buffer. */
+  return datalen;
+}
+
+
+/* fetch many resources from the same server, several at a time */
+int http_get_multi(const char *host, unsigned short port, const char **paths, int count, int maxconn, http_multi_cb done, void *ctx) {
+  CURLM *multi;
+  struct transfer *slots;
+  int next = 0, active = 0, running, i;
+
+  if (maxconn < 1)
+    maxconn = 1;
+  multi = curl_multi_init();
+  slots = calloc((size_t) maxconn, sizeof(*slots));
+  if (!multi || !slots) {
+    if (multi)
+      curl_multi_cleanup(multi);
+    free(slots);
+    return(-1);
+  }
+  /* A single server: let curl reuse connections, but not open more. */
+  curl_multi_setopt(multi, CURLMOPT_MAX_HOST_CONNECTIONS, (long) maxconn);
+
+  while (next < count || active > 0) {
+    CURLMsg *msg;
+    int msgs;
+
+    /* Start new transfers while there are free slots. */
+    for (i = 0; i < maxconn && next < count; i++) {
+      unsigned char *data;
+
+      if (slots[i].easy)
+        continue;
+      if (transfer_setup(&slots[i], host, port, paths[next], NULL, NULL)) {
+        transfer_finish(&slots[i], (CURLcode) -1, paths[next], &data);
+        done(ctx, next++, NULL, 0);
+        continue;
       }
+      slots[i].idx = next++;
+      curl_multi_add_handle(multi, slots[i].easy);
+      active++;
     }
+
+    /* Let transfers progress, then wait for network activity. */
+    if (curl_multi_perform(multi, &running) != CURLM_OK)
+      break;
+    while ((msg = curl_multi_info_read(multi, &msgs))) {
+      struct transfer *t = NULL;
+      unsigned char *data;
+      size_t len;
+      int idx;
+
+      if (msg->msg != CURLMSG_DONE)
+        continue;
+      curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, (char **) &t);
+      curl_multi_remove_handle(multi, msg->easy_handle);
+      idx = t->idx;
+      len = transfer_finish(t, msg->data.result, paths[idx], &data);
+      active--;
+      done(ctx, idx, data, len);
+    }
+    if (active > 0)
+      curl_multi_poll(multi, NULL, 0, 1000, NULL);
   }
 
-  /* Clean up and return. */
-  curl_easy_cleanup(easy);
-  curl_free(urlstring);
-  curl_url_cleanup(url);
-  *resptr = ctrl.buffer;
+  /* Abort whatever is left (only on multi handle failure). */
+  for (i = 0; i < maxconn; i++) {
+    if (slots[i].easy) {
+      unsigned char *data;
+      int idx = slots[i].idx;
 
-  return(ctrl.datalen);
+      curl_multi_remove_handle(multi, slots[i].easy);
+      transfer_finish(&slots[i], (CURLcode) -1, paths[idx], &data);
+      done(ctx, idx, NULL, 0);
+    }
+  }
+  curl_multi_cleanup(multi);
+  free(slots);
+  return(next < count? -1: 0);
 }
@@ -26,77 +26,258 @@
  */
 
 #if defined(_WIN32) || defined(WIN32)
-  #include <winsock2.h>  /* gethostbyname() on nonstandard, exotic platforms */
+  #include <winsock2.h>  /* sockets on nonstandard, exotic platforms */
+  #include <ws2tcpip.h>  /* getaddrinfo() */
 #else
-  #include <netdb.h>     /* gethostbyname() on posix */
+  #include <fcntl.h>     /* fcntl(), O_NONBLOCK */
+  #include <netdb.h>     /* getaddrinfo() on posix */
+  #include <sys/select.h>
+  #include <sys/socket.h>
 #endif
 
+#include <ctype.h>  /* tolower() */
 #include <errno.h>
 #include <unistd.h> /* NULL */
 #include <string.h> /* memcpy() */
 #include <stdlib.h> /* realloc(), malloc() */
 #include <stdio.h>  /* sprintf() */
+#include <time.h>   /* time() */
 
+#include "gz.h"
 #include "net.h"
 
+#define NET_CONNECT_TIMEOUT 10 /* seconds allowed to establish a connection */
+#define NET_READ_TIMEOUT 15    /* seconds of silence after which a server is considered dead */
+#define NETPOOL_SIZE 4         /* max number of idle keep-alive connections */
+#define NETPOOL_IDLE 4         /* seconds after which an idle connection is not trusted any more (servers often keep them 5 s) */
+
+/* a socket must be closed with closesocket() on Windows */
+#ifdef _WIN32
+#define CLOSESOCK(x) closesocket(x)
+#else
+#define CLOSESOCK(x) close(x)
+#endif
+
+/* writing to a connection the server has already closed must fail with
+ * EPIPE, not raise SIGPIPE (which would kill the game). BSD and macOS have
+ * no MSG_NOSIGNAL, SO_NOSIGPIPE is set on their sockets instead */
+#ifdef MSG_NOSIGNAL
+#define SENDFLAGS MSG_NOSIGNAL
+#else
+#define SENDFLAGS 0
+#endif
+
+/* idle keep-alive connections, ready for reuse by the next request to the same host:port */
+static struct {
+  char host[256];
+  unsigned short port;
+  int sock;          /* -1 if slot is free */
+  time_t lastuse;
+} netpool[NETPOOL_SIZE];
+
+static SDL_mutex *netpool_mutex; /* transfers may run on several threads */
+
 void init_net(void) {
+  int i;
   #if defined(_WIN32) || defined(WIN32)
   WSADATA wsaData;
   WSAStartup(MAKEWORD(2,2), &wsaData);
   #endif
+  for (i = 0; i < NETPOOL_SIZE; i++) netpool[i].sock = -1;
+  netpool_mutex = SDL_CreateMutex();
 }
 
 void cleanup_net(void) {
+  int i;
+  for (i = 0; i < NETPOOL_SIZE; i++) {
+    if (netpool[i].sock >= 0) CLOSESOCK(netpool[i].sock);
+    netpool[i].sock = -1;
+  }
+  if (netpool_mutex != NULL) SDL_DestroyMutex(netpool_mutex);
+  netpool_mutex = NULL;
 #if defined(_WIN32) || defined(WIN32)
   WSACleanup();
 #endif
 }
 
-/* a socket must be closed with closesocket() on Windows */
+
+/* returns non-zero if an idle connection is still usable. nothing is
+ * expected from the server between two requests, so a readable socket
+ * means it has been closed (EOF), reset, or is sending garbage */
+static int netpool_alive(int sock) {
+  fd_set fds;
+  struct timeval tv;
+  FD_ZERO(&fds);
+  FD_SET(sock, &fds);
+  tv.tv_sec = 0;
+  tv.tv_usec = 0;
+  return(select(sock + 1, &fds, NULL, NULL, &tv) == 0);
+}
+
+
+/* takes an idle connection to host:port out of the pool, returns -1 if none */
+static int netpool_take(const char *host, unsigned short port) {
+  int i, sock = -1;
+  time_t now = time(NULL);
+  if (netpool_mutex != NULL) SDL_LockMutex(netpool_mutex);
+  for (i = 0; i < NETPOOL_SIZE; i++) {
+    if (netpool[i].sock < 0) continue;
+    /* servers drop idle connections sooner or later */
+    if ((now - netpool[i].lastuse > NETPOOL_IDLE) || (netpool_alive(netpool[i].sock) == 0)) {
+      CLOSESOCK(netpool[i].sock);
+      netpool[i].sock = -1;
+      continue;
+    }
+    if ((sock < 0) && (netpool[i].port == port) && (strcmp(netpool[i].host, host) == 0)) {
+      sock = netpool[i].sock;
+      netpool[i].sock = -1;
+    }
+  }
+  if (netpool_mutex != NULL) SDL_UnlockMutex(netpool_mutex);
+  return(sock);
+}
+
+
+/* hands a connection that is still usable back to the pool, closing the
+ * least recently used one if the pool is full */
+static void netpool_give(const char *host, unsigned short port, int sock) {
+  int i, slot = 0;
+  if (strlen(host) >= sizeof(netpool[0].host)) {
+    CLOSESOCK(sock);
+    return;
+  }
+  if (netpool_mutex != NULL) SDL_LockMutex(netpool_mutex);
+  for (i = 0; i < NETPOOL_SIZE; i++) {
+    if (netpool[i].sock < 0) {
+      slot = i;
+      break;
+    }
+    if (netpool[i].lastuse < netpool[slot].lastuse) slot = i;
+  }
+  if (netpool[slot].sock >= 0) CLOSESOCK(netpool[slot].sock);
+  strcpy(netpool[slot].host, host);
+  netpool[slot].port = port;
+  netpool[slot].sock = sock;
+  netpool[slot].lastuse = time(NULL);
+  if (netpool_mutex != NULL) SDL_UnlockMutex(netpool_mutex);
+}
+
+
+/* switches a socket between blocking and non-blocking modes */
+static void setblocking(int sock, int blocking) {
 #ifdef _WIN32
-#define CLOSESOCK(x) closesocket(x)
+  u_long nonblock = (blocking != 0) ? 0 : 1;
+  ioctlsocket(sock, FIONBIO, &nonblock);
 #else
-#define CLOSESOCK(x) close(x)
+  int flags = fcntl(sock, F_GETFL, 0);
+  if (blocking != 0) {
+    fcntl(sock, F_SETFL, flags & ~O_NONBLOCK);
+  } else {
+    fcntl(sock, F_SETFL, flags | O_NONBLOCK);
+  }
 #endif
+}
 
 
-/* open socket to remote host/port and return its socket descriptor */
-static int makeSocket(const char *host, unsigned short portnum) {
-  int sock;
-  struct sockaddr_in sa; /* Socket address */
-  struct hostent *hp;    /* Host entity */
+/* waits until sock is readable (or writable if forwrite is set), giving up
+ * after timeout seconds or when the transfer gets cancelled. returns 0 when
+ * the socket is ready. Windows reports a failed non-blocking connect() only
+ * through the exception set, so it is watched too when waiting to write */
+static int waitsock(int sock, int forwrite, int timeout, struct netprogress *progress) {
+  long waited;
+  fd_set fds, excfds;
+  struct timeval tv;
+  /* wait in small steps, so a cancellation is noticed quickly */
+  for (waited = 0; waited < timeout * 1000L; waited += 200) {
+    if ((progress != NULL) && (SDL_AtomicGet(&(progress->cancel)) != 0)) return(-1);
+    FD_ZERO(&fds);
+    FD_SET(sock, &fds);
+    FD_ZERO(&excfds);
+    FD_SET(sock, &excfds);
+    tv.tv_sec = 0;
+    tv.tv_usec = 200000;
+    if (select(sock + 1, (forwrite != 0) ? NULL : &fds, (forwrite != 0) ? &fds : NULL, (forwrite != 0) ? &excfds : NULL, &tv) != 0) return(0); /* ready, or error (that the next call will report) */
+  }
+  return(-1);
+}
 
-  hp = gethostbyname(host);
-  if (hp == NULL) return(-1);
 
-  /* Copy host address from hostent to (server) socket address */
-  memcpy((char *)&sa.sin_addr, (char *)hp->h_addr, hp->h_length);
-  sa.sin_family = hp->h_addrtype;  /* Set service sin_family to PF_INET */
-  sa.sin_port = htons(portnum);       /* Put portnum into sockaddr */
+/* open socket to remote host/port and return its socket descriptor. every
+ * address host resolves to (IPv6 or IPv4) is tried in turn */
+static int netconnect(const char *host, unsigned short portnum, struct netprogress *progress) {
+  struct addrinfo hints, *addrs, *ai;
+  char portstr[8];
+  int sock = -1, err;
+  socklen_t errlen;
 
-  /* open socket */
-  sock = socket(hp->h_addrtype, SOCK_STREAM, 0);
-  if (sock == -1) return(-1);
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  sprintf(portstr, "%u", portnum);
+  if (getaddrinfo(host, portstr, &hints, &addrs) != 0) return(-1);
 
-  /* connect to remote host */
-  if (connect(sock, (struct sockaddr *)&sa, sizeof(sa)) == -1) {
+  for (ai = addrs; ai != NULL; ai = ai->ai_next) {
+    sock = (int)socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+    if (sock < 0) continue;
+#ifdef SO_NOSIGPIPE
+    err = 1;
+    setsockopt(sock, SOL_SOCKET, SO_NOSIGPIPE, &err, sizeof(err));
+#endif
+    /* connect without blocking, so it can time out */
+    setblocking(sock, 0);
+    if (connect(sock, ai->ai_addr, (int)ai->ai_addrlen) == 0) break;
+    if (waitsock(sock, 1, NET_CONNECT_TIMEOUT, progress) == 0) {
+      err = -1;
+      errlen = sizeof(err);
+      if ((getsockopt(sock, SOL_SOCKET, SO_ERROR, (char *)&err, &errlen) == 0) && (err == 0)) break;
+    }
     CLOSESOCK(sock);
-    return(-1);
+    sock = -1;
+    if ((progress != NULL) && (SDL_AtomicGet(&(progress->cancel)) != 0)) break;
   }
-
+  freeaddrinfo(addrs);
+  if (sock >= 0) setblocking(sock, 1);
   return(sock);
 }
 
-static long readline(int sock, char *buf, long maxlen) {
-  long res, bufpos = 0;
-  char bytebuff;
+
+/* buffered reader over a socket, so headers are not read byte by byte */
+struct sockreader {
+  int sock;
+  struct netprogress *progress;
+  long len;   /* amount of bytes in buf */
+  long pos;   /* next byte to be consumed */
+  unsigned char buf[4096];
+};
+
+/* refills the reader's buffer, returns the amount of bytes available (0 on EOF or error) */
+static long reader_fill(struct sockreader *r) {
+  if (r->pos < r->len) return(r->len - r->pos);
+  r->pos = 0;
+  r->len = 0;
+  if (waitsock(r->sock, 0, NET_READ_TIMEOUT, r->progress) != 0) return(0); /* timeout or cancelled */
+  r->len = recv(r->sock, (char *)r->buf, sizeof(r->buf), 0);
+  if (r->len < 0) {
+    printf("Err: %s\n", strerror(errno));
+    r->len = 0;
+  }
+  return(r->len);
+}
+
+/* reads a CRLF (or LF) terminated line into buf, without its terminator.
+ * returns the line's length, or -1 on EOF */
+static long readline(struct sockreader *r, char *buf, long maxlen) {
+  long bufpos = 0;
+  unsigned char c;
   for (;;) {
-    res = recv(sock, &bytebuff, 1, 0);
-    if (res < 1) break;
-    if (bytebuff == '\r') continue;
-    if (bytebuff == '\n') break;
-    buf[bufpos++] = bytebuff;
-    if (bufpos >= maxlen - 1) break;
+    if (reader_fill(r) == 0) {
+      if (bufpos == 0) return(-1);
+      break;
+    }
+    c = r->buf[r->pos++];
+    if (c == '\r') continue;
+    if (c == '\n') break;
+    if (bufpos < maxlen - 1) buf[bufpos++] = (char)c;
   }
   buf[bufpos] = 0;
   return(bufpos);
@@ -105,64 +286,324 @@ static long readline(int sock, char *buf, long maxlen) {
 /* fetch a resource from host/path on defined port using http and return a pointer to the allocated chunk of memory
  * Note: do not forget to free the memory afterwards! */
 size_t http_get(const char *host, unsigned short port, const char *path, unsigned char **resptr) {
-  #define BUFLEN 2048
-  size_t resalloc = 1024;
-  size_t reslen = 0;
-  char linebuf[BUFLEN];
-  long len;
-  int sock;
-  unsigned char *res;
-  *resptr = NULL;
-  res = NULL;
-  sock = makeSocket(host, port);
-  if (sock < 0) {
-    printf("makeSocket() err: %s\n", strerror(errno));
+  return(http_request(host, port, path, resptr, NULL, NULL));
+}
+
+/* copies the value of header line if it is named name (case insensitive),
+ * returns non-zero on match */
+static int getheader(const char *line, const char *name, char *value, size_t maxlen) {
+  size_t i, namelen = strlen(name);
+  for (i = 0; i < namelen; i++) {
+    if (tolower((unsigned char)line[i]) != tolower((unsigned char)name[i])) return(0);
+  }
+  if (line[namelen] != ':') return(0);
+  line += namelen + 1;
+  while ((*line == ' ') || (*line == '\t')) line++;
+  snprintf(value, maxlen, "%s", line);
+  return(1);
+}
+
+/* growable response body */
+struct resbuf {
+  unsigned char *data;
+  size_t len;
+  size_t alloc;
+  FILE *fd;     /* if set, the body is written there instead of kept in memory */
+};
+
+/* makes sure res can hold extra more bytes (plus a NULL terminator), returns 0 on success */
+static int resbuf_reserve(struct resbuf *res, size_t extra) {
+  unsigned char *newdata;
+  size_t newalloc = res->alloc;
+  if (res->fd != NULL) return(0);
+  if (res->len + extra > DATA_SIZE_LIMIT) return(-1);
+  if (res->len + extra + 1 <= res->alloc) return(0);
+  if (newalloc < 1024) newalloc = 1024;
+  while (res->len + extra + 1 > newalloc) newalloc *= 2;
+  newdata = realloc(res->data, newalloc);
+  if (newdata == NULL) return(-1);
+  res->data = newdata;
+  res->alloc = newalloc;
+  return(0);
+}
+
+/* appends data to a resbuf (used as a gzstream sink) */
+static int resbuf_append(void *ctx, const unsigned char *data, size_t len) {
+  struct resbuf *res = ctx;
+  if (res->fd != NULL) {
+    if (fwrite(data, 1, len, res->fd) != len) return(-1);
+    res->len += len;
     return(0);
   }
-  snprintf(linebuf, BUFLEN - 1, "GET %s HTTP/1.1\r\nHost: %s\r\nConnection: close\r\n\r\n", path, host);
-  send(sock, linebuf, strlen(linebuf), 0);
-  /* trash out all headers */
+  if (resbuf_reserve(res, len) != 0) return(-1);
+  memcpy(res->data + res->len, data, len);
+  res->len += len;
+  return(0);
+}
+
+/* where body bytes go: straight to res, or through the inflater first */
+struct bodysink {
+  struct resbuf res;
+  struct gzstream *gz;  /* non-NULL if the body is gzip-encoded */
+  long wirelen;         /* bytes received from the network */
+};
+
+static int bodysink_put(struct bodysink *sink, const unsigned char *data, size_t len) {
+  sink->wirelen += (long)len;
+  if (sink->gz != NULL) return(gzstream_feed(sink->gz, data, len, resbuf_append, &(sink->res)));
+  return(resbuf_append(&(sink->res), data, len));
+}
+
+/* returns non-zero if len bytes exceed the body size limit of progress */
+static int overlimit(struct netprogress *progress, long len) {
+  long limit;
+  if (progress == NULL) return(0);
+  limit = SDL_AtomicGet(&(progress->limit));
+  return((limit > 0) && (len > limit));
+}
+
+/* moves up to maxlen bytes of body from the reader to sink. maxlen < 0 means
+ * "until the connection closes". returns 0 on success */
+static int readbody(struct sockreader *r, struct bodysink *sink, long maxlen, struct netprogress *progress) {
+  long avail;
+  while (maxlen != 0) {
+    if ((progress != NULL) && (SDL_AtomicGet(&(progress->cancel)) != 0)) return(-1);
+    avail = reader_fill(r);
+    if (avail == 0) return((maxlen < 0) ? 0 : -1); /* premature EOF is only fine if no size is known */
+    if ((maxlen > 0) && (avail > maxlen)) avail = maxlen;
+    if (bodysink_put(sink, r->buf + r->pos, (size_t)avail) != 0) return(-1);
+    if (overlimit(progress, (long)sink->res.len) != 0) return(-1);
+    r->pos += avail;
+    if (maxlen > 0) maxlen -= avail;
+    if (progress != NULL) SDL_AtomicSet(&(progress->received), (int)sink->wirelen);
+  }
+  return(0);
+}
+
+/* decodes a "Transfer-Encoding: chunked" body into sink, returns 0 on success */
+static int readchunked(struct sockreader *r, struct bodysink *sink, struct netprogress *progress) {
+  char line[256];
+  long chunklen;
   for (;;) {
-    len = readline(sock, linebuf, BUFLEN);
+    if (readline(r, line, sizeof(line)) < 0) return(-1);
+    chunklen = strtol(line, NULL, 16); /* chunk extensions after ';' are ignored */
+    if (chunklen < 0) return(-1);
+    if (chunklen == 0) break;
+    if (readbody(r, sink, chunklen, progress) != 0) return(-1);
+    if (readline(r, line, sizeof(line)) != 0) return(-1); /* CRLF after chunk data */
+  }
+  /* skip trailer headers up to the final empty line */
+  for (;;) {
+    long len = readline(r, line, sizeof(line));
+    if (len < 0) return(-1);
     if (len == 0) break;
   }
-  /* preallocate initial buffer */
-  res = malloc(resalloc);
-  if (res == NULL) {
-    CLOSESOCK(sock);
-    return(0);
+  return(0);
+}
+
+/* sends the request over r->sock and reads the status line and headers of
+ * the response. returns the HTTP status, 0 if no response came at all */
+static int sendrequest(struct sockreader *r, const char *host, const char *path, struct httpmeta *meta, long *contentlen, int *chunked, int *gzipped, int *keepalive) {
+  #define BUFLEN 2048
+  char linebuf[BUFLEN], value[64];
+  long len;
+  int i, status = 0;
+
+  snprintf(linebuf, BUFLEN - 1, "GET %s HTTP/1.1\r\nHost: %s\r\nAccept-Encoding: gzip\r\n", path, host);
+  if ((meta != NULL) && (meta->etag[0] != 0)) snprintf(linebuf + strlen(linebuf), BUFLEN - 1 - strlen(linebuf), "If-None-Match: %s\r\n", meta->etag);
+  if ((meta != NULL) && (meta->lastmodified[0] != 0)) snprintf(linebuf + strlen(linebuf), BUFLEN - 1 - strlen(linebuf), "If-Modified-Since: %s\r\n", meta->lastmodified);
+  strcat(linebuf, "\r\n");
+  if (send(r->sock, linebuf, strlen(linebuf), SENDFLAGS) != (long)strlen(linebuf)) return(0);
+
+  *contentlen = -1;
+  *chunked = 0;
+  *gzipped = 0;
+  *keepalive = 0;
+  if (meta != NULL) {
+    meta->etag[0] = 0;
+    meta->lastmodified[0] = 0;
   }
-  /* fetch data */
-  for (;;) {
-    len = recv(sock, linebuf, BUFLEN, 0);
+  for (i = 0;; i++) {
+    len = readline(r, linebuf, BUFLEN);
+    if (len < 0) return(0); /* connection closed before the end of headers */
     if (len == 0) break;
-    if (len < 0) {
-      printf("Err: %s\n", strerror(errno));
-      free(res);
-      CLOSESOCK(sock);
-      return(0);
+    if (i == 0) {
+      if ((strncmp(linebuf, "HTTP/", 5) == 0) && (strchr(linebuf, ' ') != NULL)) status = atoi(strchr(linebuf, ' ') + 1);
+      if (strncmp(linebuf, "HTTP/1.1 ", 9) == 0) *keepalive = 1; /* HTTP/1.1 keeps connections open by default */
+    } else if (getheader(linebuf, "Content-Length", value, sizeof(value))) {
+      *contentlen = strtol(value, NULL, 10);
+    } else if (getheader(linebuf, "Transfer-Encoding", value, sizeof(value))) {
+      if (strstr(value, "chunked") != NULL) *chunked = 1;
+    } else if (getheader(linebuf, "Content-Encoding", value, sizeof(value))) {
+      if (strstr(value, "gzip") != NULL) *gzipped = 1;
+    } else if (getheader(linebuf, "Connection", value, sizeof(value))) {
+      if ((value[0] == 'c') || (value[0] == 'C')) *keepalive = 0; /* "close" */
+    } else if (meta != NULL) {
+      getheader(linebuf, "ETag", meta->etag, sizeof(meta->etag));
+      getheader(linebuf, "Last-Modified", meta->lastmodified, sizeof(meta->lastmodified));
     }
-    if (reslen + (size_t) len > DATA_SIZE_LIMIT) {
-      free(res);
-      CLOSESOCK(sock);
-      return 0;
+  }
+  return(status);
+}
+
+/* runs a request, the body going either to memory (*resptr) or to fd if it
+ * is not NULL. only a "200 OK" response returns data. connections are kept
+ * open and reused by later requests to the same server */
+static size_t http_fetch(const char *host, unsigned short port, const char *path, unsigned char **resptr, FILE *fd, struct netprogress *progress, struct httpmeta *meta) {
+  struct sockreader *r;
+  struct bodysink sink;
+  long contentlen;
+  int attempt, reused, status = 0, chunked, gzipped, keepalive, err;
+
+  *resptr = NULL;
+  if (meta != NULL) meta->status = 0;
+  r = malloc(sizeof(struct sockreader));
+  if (r == NULL) return(0);
+  r->progress = progress;
+
+  /* a pooled connection may have been closed by the server in the meantime,
+   * in which case the request is tried again over a fresh one */
+  for (attempt = 0; attempt < 2; attempt++) {
+    r->len = 0;
+    r->pos = 0;
+    r->sock = netpool_take(host, port);
+    reused = (r->sock >= 0);
+    if (reused == 0) r->sock = netconnect(host, port, progress);
+    if (r->sock < 0) {
+      printf("netconnect() failed to reach %s:%u\n", host, port);
+      free(r);
+      return(0);
     }
-    while (reslen + (size_t)len + 1 > resalloc) {
-      unsigned char *newres = realloc(res, resalloc *= 2);
-
-      if (newres == NULL) {
-        free(res);
-        CLOSESOCK(sock);
-        return(0);
-      }
-      res = newres;
+    status = sendrequest(r, host, path, meta, &contentlen, &chunked, &gzipped, &keepalive);
+    if ((status != 0) || (reused == 0)) break;
+    CLOSESOCK(r->sock);
+  }
+  if (meta != NULL) meta->status = status;
+
+  /* anything else than 200 is an error (or a "not modified" answer) */
+  if (status != 200) {
+    if ((status != 0) && (status != 304)) printf("http error %d for %s\n", status, path);
+    /* a 304 has no body, so the connection is still good */
+    if ((status == 304) && (keepalive != 0) && (r->pos == r->len)) {
+      netpool_give(host, port, r->sock);
+    } else {
+      CLOSESOCK(r->sock);
     }
-    memcpy(&(res[reslen]), linebuf, (size_t)len);
-    reslen += (size_t)len;
+    free(r);
+    return(0);
+  }
+
+  /* fetch data, allocating exactly what is announced if anything is. gzip
+   * bodies are inflated as they arrive, so only the decompressed copy is kept */
+  memset(&sink, 0, sizeof(sink));
+  sink.res.fd = fd;
+  err = 0;
+  if (gzipped != 0) {
+    sink.gz = gzstream_new();
+    if (sink.gz == NULL) err = -1;
+  }
+  if ((contentlen >= 0) && (progress != NULL)) SDL_AtomicSet(&(progress->total), (int)contentlen);
+  if (overlimit(progress, contentlen) != 0) err = -1; /* no need to even start */
+  if ((err == 0) && (chunked != 0)) {
+    err = readchunked(r, &sink, progress);
+  } else if (err == 0) {
+    if ((fd == NULL) && (contentlen > DATA_SIZE_LIMIT)) contentlen = DATA_SIZE_LIMIT + 1; /* will fail */
+    if ((contentlen >= 0) && (gzipped == 0)) err = resbuf_reserve(&(sink.res), (size_t)contentlen);
+    if (err == 0) err = readbody(r, &sink, contentlen, progress);
+  }
+  if ((err == 0) && (sink.gz != NULL) && (gzstream_finished(sink.gz) == 0)) err = -1; /* truncated gzip stream */
+  gzstream_free(sink.gz);
+  /* keep the connection if the body was delimited and entirely consumed */
+  if ((err == 0) && (keepalive != 0) && ((chunked != 0) || (contentlen >= 0)) && (r->pos == r->len)) {
+    netpool_give(host, port, r->sock);
+  } else {
+    CLOSESOCK(r->sock);
+  }
+  free(r);
+  if (fd != NULL) return((err != 0) ? 0 : sink.res.len);
+  if ((err != 0) || (resbuf_reserve(&(sink.res), 0) != 0)) {
+    free(sink.res.data);
+    return(0);
+  }
+  sink.res.data[sink.res.len] = 0; /* terminate data with a NULL, just in case (I don't know what the caller will want to do with the data..) */
+  *resptr = sink.res.data;
+
+  return(sink.res.len);
+}
+
+/* same as http_get(), reporting progress, watching for cancellation and
+ * handling conditional requests */
+size_t http_request(const char *host, unsigned short port, const char *path, unsigned char **resptr, struct netprogress *progress, struct httpmeta *meta) {
+  return(http_fetch(host, port, path, resptr, NULL, progress, meta));
+}
+
+/* streams the body to fd as it arrives, without any size limit */
+size_t http_get_to_file(const char *host, unsigned short port, const char *path, FILE *fd, struct netprogress *progress, struct httpmeta *meta) {
+  unsigned char *res;
+  return(http_fetch(host, port, path, &res, fd, progress, meta));
+}
+
+
+/* state shared by the workers of http_get_multi() */
+struct multijob {
+  const char *host;
+  unsigned short port;
+  const char **paths;
+  int count;
+  SDL_atomic_t next;   /* index of the next path to fetch */
+  SDL_mutex *cbmutex;  /* serializes calls to done() */
+  http_multi_cb done;
+  void *ctx;
+};
+
+
+static int multi_worker(void *arg) {
+  struct multijob *job = arg;
+  unsigned char *data;
+  size_t len;
+  int idx;
+
+  for (;;) {
+    idx = SDL_AtomicAdd(&(job->next), 1);
+    if (idx >= job->count) break;
+    data = NULL;
+    len = http_request(job->host, job->port, job->paths[idx], &data, NULL, NULL);
+    if (len == 0) data = NULL;
+    SDL_LockMutex(job->cbmutex);
+    job->done(job->ctx, idx, data, len);
+    SDL_UnlockMutex(job->cbmutex);
+  }
+  return(0);
+}
+
+
+/* fetch many resources from the same server, several at a time. the HTTP
+ * reader above is blocking, so parallelism comes from worker threads, each
+ * running its own keep-alive connection out of the pool */
+int http_get_multi(const char *host, unsigned short port, const char **paths, int count, int maxconn, http_multi_cb done, void *ctx) {
+  struct multijob job;
+  SDL_Thread *workers[NETPOOL_SIZE];
+  int i, started = 0;
+
+  if (maxconn > NETPOOL_SIZE) maxconn = NETPOOL_SIZE;
+  if (maxconn > count) maxconn = count;
+  job.host = host;
+  job.port = port;
+  job.paths = paths;
+  job.count = count;
+  job.done = done;
+  job.ctx = ctx;
+  SDL_AtomicSet(&(job.next), 0);
+  job.cbmutex = SDL_CreateMutex();
+  if (job.cbmutex == NULL) return(-1);
+
+  for (i = 1; i < maxconn; i++) {
+    workers[started] = SDL_CreateThread(multi_worker, "http_get_multi", &job);
+    if (workers[started] != NULL) started++;
   }
-  CLOSESOCK(sock);
-  res[reslen] = 0; /* terminate data with a NULL, just in case (I don't know what the caller will want to do with the data..) */
-  *resptr = res;
+  multi_worker(&job); /* the calling thread works too */
+  for (i = 0; i < started; i++) SDL_WaitThread(workers[i], NULL);
 
-  return(reslen);
+  SDL_DestroyMutex(job.cbmutex);
+  return(0);
 }
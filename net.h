@@ -27,6 +27,9 @@
 #ifndef http_h_sentinel
 #define http_h_sentinel
 
+  #include <stdio.h>    /* FILE */
+  #include <SDL2/SDL.h> /* SDL_atomic_t */
+
   /* HTTP download data size limit (# bytes). */
   #define DATA_SIZE_LIMIT (4 * 1024 * 1024 - 1)
 
@@ -38,4 +41,43 @@
  * Note: do not forget to free the memory afterwards! */
   size_t http_get(const char *host, unsigned short port, const char *path, unsigned char **resptr);
 
+/* state of a transfer, shared between the thread running it and the UI */
+  struct netprogress {
+    SDL_atomic_t received; /* bytes received so far */
+    SDL_atomic_t total;    /* expected size in bytes, 0 if unknown */
+    SDL_atomic_t cancel;   /* set to non-zero to abort the transfer */
+    SDL_atomic_t limit;    /* if non-zero, max body size: larger ones abort */
+  };
+
+/* metadata of an HTTP response, also used to make requests conditional */
+  struct httpmeta {
+    int status;             /* HTTP status code of the response, 0 if none */
+    char etag[128];         /* ETag validator, empty if none */
+    char lastmodified[64];  /* Last-Modified validator, empty if none */
+  };
+
+/* same as http_get(), but keeps progress (if not NULL) updated while the
+ * transfer runs, and aborts it as soon as progress->cancel is set or the
+ * body turns out to be larger than progress->limit. if meta
+ * is not NULL, its validators (if any) are sent as If-None-Match and
+ * If-Modified-Since, and it is then filled with what the server returned.
+ * a "304 Not Modified" answer returns no data at all. */
+  size_t http_request(const char *host, unsigned short port, const char *path, unsigned char **resptr, struct netprogress *progress, struct httpmeta *meta);
+
+/* same as http_request(), but the body is written to fd as it arrives
+ * instead of being kept in memory, so DATA_SIZE_LIMIT does not apply.
+ * returns the amount of bytes written, 0 on failure (fd then holds partial
+ * data) or if the server answered "304 Not Modified" */
+  size_t http_get_to_file(const char *host, unsigned short port, const char *path, FILE *fd, struct netprogress *progress, struct httpmeta *meta);
+
+/* called once per completed transfer of http_get_multi(), with the index of
+ * its path and its data (NULL on failure). data belongs to the callback. */
+  typedef void (*http_multi_cb)(void *ctx, int idx, unsigned char *data, size_t len);
+
+/* fetches paths[0..count-1] from host, running up to maxconn transfers at
+ * a time. done is called as transfers complete, never concurrently, and
+ * exactly once per path. returns 0 on success, -1 if some paths were never
+ * attempted */
+  int http_get_multi(const char *host, unsigned short port, const char **paths, int count, int maxconn, http_multi_cb done, void *ctx);
+
 #endif
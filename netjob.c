@@ -0,0 +1,155 @@
+/*
+ * background HTTP transfers, so the UI keeps running while levels download.
+ *
+ * Copyright (C) 2014-2023 Mateusz Viste
+ *
+ * MIT License
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdlib.h> /* malloc(), free() */
+#include <string.h> /* strdup() */
+
+#include <SDL2/SDL.h>
+
+#include "httpcache.h"
+#include "net.h"
+#include "netjob.h"
+
+struct netjob {
+  char *host;
+  char *path;
+  char *filename;        /* if set, the body is streamed to this file */
+  unsigned short port;
+  struct netprogress progress;
+  unsigned char *res;
+  size_t reslen;
+  SDL_atomic_t done;     /* set by the worker once res/reslen are valid */
+  SDL_atomic_t refcount; /* the worker and the owner both hold a reference */
+};
+
+static Uint32 eventtype = (Uint32)-1;
+
+
+/* drops a reference to job, and frees it when nobody holds it any more */
+static void netjob_release(struct netjob *job) {
+  if (SDL_AtomicAdd(&(job->refcount), -1) != 1) return;
+  free(job->res);
+  free(job->host);
+  free(job->path);
+  free(job->filename);
+  free(job);
+}
+
+
+static int netjob_worker(void *arg) {
+  struct netjob *job = arg;
+  SDL_Event event;
+
+  if (job->filename != NULL) {
+    job->reslen = httpcache_get_to_file(job->host, job->port, job->path, job->filename, &(job->res), &(job->progress));
+  } else {
+    job->reslen = httpcache_get(job->host, job->port, job->path, &(job->res), &(job->progress));
+  }
+  SDL_AtomicSet(&(job->done), 1);
+
+  /* wake up the UI, unless nobody is waiting any more */
+  if (SDL_AtomicGet(&(job->progress.cancel)) == 0) {
+    memset(&event, 0, sizeof(event));
+    event.type = eventtype;
+    SDL_PushEvent(&event);
+  }
+
+  netjob_release(job);
+  return(0);
+}
+
+
+Uint32 netjob_eventtype(void) {
+  if (eventtype == (Uint32)-1) eventtype = SDL_RegisterEvents(1);
+  return(eventtype);
+}
+
+
+static struct netjob *netjob_spawn(const char *host, unsigned short port, const char *path, const char *filename, size_t maxlen) {
+  struct netjob *job;
+  SDL_Thread *thread = NULL;
+
+  netjob_eventtype(); /* make sure the event type is registered by the main thread */
+  job = calloc(1, sizeof(struct netjob));
+  if (job == NULL) return(NULL);
+  job->host = strdup(host);
+  job->path = strdup(path);
+  if (filename != NULL) job->filename = strdup(filename);
+  job->port = port;
+  SDL_AtomicSet(&(job->progress.limit), (int)maxlen);
+  SDL_AtomicSet(&(job->refcount), 2);
+  if ((job->host != NULL) && (job->path != NULL) && ((filename == NULL) || (job->filename != NULL))) {
+    thread = SDL_CreateThread(netjob_worker, "netjob", job);
+  }
+  if (thread == NULL) {
+    free(job->host);
+    free(job->path);
+    free(job->filename);
+    free(job);
+    return(NULL);
+  }
+  SDL_DetachThread(thread);
+  return(job);
+}
+
+
+struct netjob *netjob_start(const char *host, unsigned short port, const char *path, size_t maxlen) {
+  return(netjob_spawn(host, port, path, NULL, maxlen));
+}
+
+
+struct netjob *netjob_start_tofile(const char *host, unsigned short port, const char *path, const char *filename) {
+  return(netjob_spawn(host, port, path, filename, 0));
+}
+
+
+int netjob_isdone(struct netjob *job) {
+  return(SDL_AtomicGet(&(job->done)));
+}
+
+
+void netjob_progress(struct netjob *job, long *received, long *total) {
+  *received = SDL_AtomicGet(&(job->progress.received));
+  *total = SDL_AtomicGet(&(job->progress.total));
+}
+
+
+size_t netjob_finish(struct netjob *job, unsigned char **resptr) {
+  size_t reslen;
+  /* a job can only be finished once the worker is done with it */
+  while (SDL_AtomicGet(&(job->done)) == 0) SDL_Delay(10);
+  *resptr = job->res;
+  reslen = job->reslen;
+  job->res = NULL; /* ownership goes to the caller */
+  netjob_release(job);
+  return(reslen);
+}
+
+
+void netjob_cancel(struct netjob *job) {
+  SDL_AtomicSet(&(job->progress.cancel), 1);
+  netjob_release(job);
+}
@@ -0,0 +1,63 @@
+/*
+ * background HTTP transfers, so the UI keeps running while levels download.
+ *
+ * Copyright (C) 2014-2023 Mateusz Viste
+ *
+ * MIT License
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef NETJOB_H
+#define NETJOB_H
+
+#include <SDL2/SDL.h>
+
+struct netjob; /* opaque, one running (or finished) transfer */
+
+/* starts fetching host/path on a worker thread. once the transfer is over,
+ * an event of type netjob_eventtype() is pushed to SDL's queue. a non-zero
+ * maxlen makes the transfer fail as soon as the data turns out to be larger
+ * than that. returns NULL if the thread could not be started. */
+struct netjob *netjob_start(const char *host, unsigned short port, const char *path, size_t maxlen);
+
+/* same as netjob_start(), but for resources that may be too large to be
+ * held in memory, see httpcache_get_to_file(): netjob_finish() returns
+ * either the data in memory (a small enough cached copy), or the size of
+ * filename with *resptr set to NULL. */
+struct netjob *netjob_start_tofile(const char *host, unsigned short port, const char *path, const char *filename);
+
+/* returns the SDL event type used to signal completion of jobs */
+Uint32 netjob_eventtype(void);
+
+/* returns non-zero once the transfer is over (successfully or not) */
+int netjob_isdone(struct netjob *job);
+
+/* fills bytes received so far, and the expected total (0 if unknown) */
+void netjob_progress(struct netjob *job, long *received, long *total);
+
+/* collects the result of a finished job and releases the job. the returned
+ * memory (NULL on failure) belongs to the caller, like with http_get() */
+size_t netjob_finish(struct netjob *job, unsigned char **resptr);
+
+/* aborts a job and releases it. returns immediately, the worker thread
+ * cleans up after itself whenever the transfer notices the cancellation */
+void netjob_cancel(struct netjob *job);
+
+#endif
@@ -0,0 +1,113 @@
+/*
+ * frame timing and draw call statistics, used by the performance overlay.
+ *
+ * Copyright (C) 2014-2023 Mateusz Viste
+ *
+ * MIT License
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <string.h> /* memset() */
+
+#include <SDL2/SDL.h>
+
+#include "perf.h"
+
+
+static struct perfframe curframe;               /* frame being built */
+static struct perfframe history[PERF_HISTORY];  /* ring of past frames */
+static int historypos, historylen;
+static Uint64 lastframeend;                     /* timestamp of the previous perf_endframe() */
+static Uint64 zonestart[PERF_ZONES];
+static SDL_Texture *lasttexture;
+static int suspended;
+
+
+Uint64 perf_gettimeus(void) {
+  static Uint64 freq = 0;
+  Uint64 counter;
+  if (freq == 0) freq = SDL_GetPerformanceFrequency();
+  counter = SDL_GetPerformanceCounter();
+  /* split the computation so the multiplication cannot overflow on high-frequency counters */
+  return((counter / freq) * 1000000 + ((counter % freq) * 1000000) / freq);
+}
+
+
+void perf_drawcall(SDL_Texture *texture) {
+  if (suspended) return;
+  curframe.drawcalls += 1;
+  if ((texture != NULL) && (texture != lasttexture)) {
+    curframe.texbinds += 1;
+    lasttexture = texture;
+  }
+}
+
+
+void perf_zone_begin(enum perfzone zone) {
+  zonestart[zone] = perf_gettimeus();
+}
+
+
+void perf_zone_end(enum perfzone zone) {
+  curframe.zonetime[zone] += perf_gettimeus() - zonestart[zone];
+}
+
+
+void perf_suspend(int flag) {
+  suspended = flag;
+}
+
+
+void perf_endframe(void) {
+  Uint64 now = perf_gettimeus();
+  if (lastframeend != 0) curframe.frametime = now - lastframeend;
+  lastframeend = now;
+  history[historypos] = curframe;
+  historypos = (historypos + 1) % PERF_HISTORY;
+  if (historylen < PERF_HISTORY) historylen += 1;
+  memset(&curframe, 0, sizeof(curframe));
+  lasttexture = NULL;
+}
+
+
+const struct perfframe *perf_lastframe(void) {
+  return(&history[(historypos + PERF_HISTORY - 1) % PERF_HISTORY]);
+}
+
+
+unsigned int perf_fps(void) {
+  Uint64 total = 0;
+  int i;
+  for (i = 0; i < historylen; i++) total += history[i].frametime;
+  if (total == 0) return(0);
+  return((unsigned int)((Uint64)historylen * 1000000 / total));
+}
+
+
+void perf_histogram(unsigned int *hist, const unsigned long *limits, int bucketscount) {
+  int i, b;
+  for (b = 0; b < bucketscount; b++) hist[b] = 0;
+  for (i = 0; i < historylen; i++) {
+    for (b = 0; b < bucketscount - 1; b++) {
+      if (history[i].frametime < limits[b]) break;
+    }
+    hist[b] += 1;
+  }
+}
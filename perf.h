@@ -0,0 +1,77 @@
+/*
+ * frame timing and draw call statistics, used by the performance overlay.
+ *
+ * Copyright (C) 2014-2023 Mateusz Viste
+ *
+ * MIT License
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef PERF_H
+#define PERF_H
+
+#include <SDL2/SDL.h>
+
+#define PERF_HISTORY 128 /* number of past frames kept for fps and histogram */
+
+/* timed sections of a frame */
+enum perfzone {
+  PERF_DRAWSCREEN,   /* building the frame (draw_screen() and friends) */
+  PERF_PRESENT,      /* SDL_RenderPresent() */
+  PERF_WAIT,         /* frame pacing (sleeping between frames) */
+  PERF_ZONES
+};
+
+/* statistics of a single frame */
+struct perfframe {
+  Uint64 frametime;              /* time elapsed since the previous frame (us) */
+  Uint64 zonetime[PERF_ZONES];   /* time spent in each zone (us) */
+  unsigned long drawcalls;       /* number of render calls */
+  unsigned long texbinds;        /* number of texture changes between render calls */
+};
+
+/* returns a monotonic timestamp in microseconds, computed from SDL's high-resolution performance counter */
+Uint64 perf_gettimeus(void);
+
+/* accounts for one render call using texture (NULL for untextured primitives) */
+void perf_drawcall(SDL_Texture *texture);
+
+/* starts / stops measuring the time spent in a zone of the current frame */
+void perf_zone_begin(enum perfzone zone);
+void perf_zone_end(enum perfzone zone);
+
+/* temporarily stops accounting draw calls (used while the overlay itself is drawn) */
+void perf_suspend(int flag);
+
+/* closes the current frame: its statistics are archived and counters reset */
+void perf_endframe(void);
+
+/* returns statistics of the last completed frame */
+const struct perfframe *perf_lastframe(void);
+
+/* returns the average number of frames per second over the recent history */
+unsigned int perf_fps(void);
+
+/* fills hist with the number of recent frames falling in each of the
+ * bucketscount buckets, bucket i holding frames faster than limits[i] us
+ * (the last bucket collects everything slower) */
+void perf_histogram(unsigned int *hist, const unsigned long *limits, int bucketscount);
+
+#endif
@@ -0,0 +1,244 @@
+/*
+ * solution playback with keyframes, so any move of a replay can be reached fast.
+ *
+ * Copyright (C) 2014-2023 Mateusz Viste
+ *
+ * MIT License
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>  /* printf() */
+#include <stdlib.h> /* malloc(), free() */
+#include <string.h> /* memcpy() */
+
+#include "sok_core.h"
+#include "playback.h"
+
+struct playback {
+  struct sokgame level;  /* initial board */
+  char *moves;           /* the replayed move string */
+  size_t len;
+  char *history;         /* history once all moves are played, like sok_move() writes it */
+  int boxcount;
+  size_t keysize;        /* bytes per keyframe: player x and y, then x and y of every box */
+  unsigned char *keys;
+  size_t *keyhist;       /* history length at every keyframe */
+};
+
+
+/* returns the number of goals without a box on them */
+static int emptygoals(const struct sokgame *game) {
+  int x, y, res = 0;
+  for (y = 0; y < game->field_height; y++) {
+    for (x = 0; x < game->field_width; x++) {
+      if ((game->field[x][y] & (field_goal | field_atom)) == field_goal) res += 1;
+    }
+  }
+  return(res);
+}
+
+
+/* plays a single move on the board, without any of the bookkeeping of
+ * sok_move(). goalsleft is the number of empty goals, kept up to date: like
+ * with sok_move(), no box can be pushed once it drops to 0. returns the
+ * history character of the move (uppercase for a push), or 0 if the move is
+ * not possible */
+static char applymove(struct sokgame *game, char move, int *goalsleft) {
+  int vx = 0, vy = 0, x, y;
+  char historychar;
+  switch (move) {
+    case 'u':
+    case 'U':
+      vy = -1;
+      historychar = 'u';
+      break;
+    case 'r':
+    case 'R':
+      vx = 1;
+      historychar = 'r';
+      break;
+    case 'd':
+    case 'D':
+      vy = 1;
+      historychar = 'd';
+      break;
+    case 'l':
+    case 'L':
+      vx = -1;
+      historychar = 'l';
+      break;
+    default:
+      return(0);
+  }
+  x = game->positionx + vx;
+  y = game->positiony + vy;
+  if ((x < 1) || (y < 1) || (x > 62) || (y > 62)) return(0);
+  if (game->field[x][y] & field_wall) return(0);
+  if (game->field[x][y] & field_atom) {
+    if (*goalsleft == 0) return(0); /* solved already */
+    if (game->field[x + vx][y + vy] & (field_wall | field_atom)) return(0);
+    game->field[x][y] &= ~field_atom;
+    game->field[x + vx][y + vy] |= field_atom;
+    if (game->field[x][y] & field_goal) *goalsleft += 1;
+    if (game->field[x + vx][y + vy] & field_goal) *goalsleft -= 1;
+    historychar -= 32; /* uppercase marks a push */
+  }
+  game->positionx = x;
+  game->positiony = y;
+  return(historychar);
+}
+
+
+/* stores the player and box positions of game as keyframe k */
+static void recordkey(struct playback *pb, size_t k, const struct sokgame *game, size_t histlen) {
+  unsigned char *key = pb->keys + k * pb->keysize;
+  int x, y;
+  *(key++) = (unsigned char)game->positionx;
+  *(key++) = (unsigned char)game->positiony;
+  for (y = 0; y < game->field_height; y++) {
+    for (x = 0; x < game->field_width; x++) {
+      if ((game->field[x][y] & field_atom) == 0) continue;
+      *(key++) = (unsigned char)x;
+      *(key++) = (unsigned char)y;
+    }
+  }
+  pb->keyhist[k] = histlen;
+}
+
+
+struct playback *playback_new(const struct sokgame *level, const char *moves) {
+  struct playback *pb;
+  struct sokgame game;
+  size_t i, histlen = 0;
+  int x, y, goalsleft;
+  char historychar;
+
+  pb = calloc(1, sizeof(struct playback));
+  if (pb == NULL) return(NULL);
+  memcpy(&(pb->level), level, sizeof(struct sokgame));
+  pb->level.solution = NULL; /* not ours */
+  for (y = 0; y < level->field_height; y++) {
+    for (x = 0; x < level->field_width; x++) {
+      if (level->field[x][y] & field_atom) pb->boxcount += 1;
+    }
+  }
+  pb->len = strlen(moves);
+  pb->keysize = 2 + 2 * (size_t)pb->boxcount;
+  pb->moves = malloc(pb->len + 1);
+  pb->history = malloc(pb->len + 1);
+  pb->keys = malloc(pb->keysize * (pb->len / PLAYBACK_KEYINTERVAL + 1));
+  pb->keyhist = malloc(sizeof(size_t) * (pb->len / PLAYBACK_KEYINTERVAL + 1));
+  if ((pb->moves == NULL) || (pb->history == NULL) || (pb->keys == NULL) || (pb->keyhist == NULL)) {
+    playback_free(pb);
+    return(NULL);
+  }
+  memcpy(pb->moves, moves, pb->len + 1);
+
+  /* play everything once, taking a snapshot every PLAYBACK_KEYINTERVAL moves */
+  memcpy(&game, &(pb->level), sizeof(struct sokgame));
+  goalsleft = emptygoals(&game);
+  for (i = 0; i < pb->len; i++) {
+    if (i % PLAYBACK_KEYINTERVAL == 0) recordkey(pb, i / PLAYBACK_KEYINTERVAL, &game, histlen);
+    historychar = applymove(&game, pb->moves[i], &goalsleft);
+    if (historychar != 0) pb->history[histlen++] = historychar;
+  }
+  if (i % PLAYBACK_KEYINTERVAL == 0) recordkey(pb, i / PLAYBACK_KEYINTERVAL, &game, histlen);
+  pb->history[histlen] = 0;
+  return(pb);
+}
+
+
+size_t playback_len(const struct playback *pb) {
+  return(pb->len);
+}
+
+
+size_t playback_seek(const struct playback *pb, struct sokgame *game, struct sokgamestates *states, size_t target) {
+  const unsigned char *key, *initial = pb->keys;
+  size_t k, i, histlen;
+  int b, goalsleft;
+
+  if (target > pb->len) target = pb->len;
+  k = target / PLAYBACK_KEYINTERVAL;
+  key = pb->keys + k * pb->keysize;
+
+  /* move boxes from their initial place to where the keyframe has them */
+  memcpy(game->field, pb->level.field, sizeof(game->field));
+  for (b = 0; b < pb->boxcount; b++) game->field[initial[2 + b * 2]][initial[3 + b * 2]] &= ~field_atom;
+  for (b = 0; b < pb->boxcount; b++) game->field[key[2 + b * 2]][key[3 + b * 2]] |= field_atom;
+  game->positionx = key[0];
+  game->positiony = key[1];
+
+  /* then play what is left up to target */
+  histlen = pb->keyhist[k];
+  goalsleft = emptygoals(game);
+  for (i = k * PLAYBACK_KEYINTERVAL; i < target; i++) {
+    if (applymove(game, pb->moves[i], &goalsleft) != 0) histlen += 1;
+  }
+  sok_rehash(game);
+
+  /* the history is the matching prefix of the whole replay's history */
+  if (histlen + 3 >= states->historyallocsize) {
+    char *newhistory;
+    size_t newsize = states->historyallocsize;
+    while (histlen + 3 >= newsize) newsize *= 2;
+    newhistory = realloc(states->history, newsize);
+    if (newhistory == NULL) {
+      printf("failed to allocate %lu bytes for history buffer!\n", (unsigned long)newsize);
+      return(playback_seek(pb, game, states, 0));
+    }
+    states->history = newhistory;
+    states->historyallocsize = newsize;
+  }
+  memcpy(states->history, pb->history, histlen);
+  states->history[histlen] = 0;
+  states->historylen = histlen;
+  states->pushes = sok_history_getpushes(states->history);
+  states->redolen = 0;
+  /* sok_move() turns the player even when the move is blocked */
+  states->angle = 0;
+  if (target > 0) {
+    switch (pb->moves[target - 1]) {
+      case 'r':
+      case 'R':
+        states->angle = 90;
+        break;
+      case 'd':
+      case 'D':
+        states->angle = 180;
+        break;
+      case 'l':
+      case 'L':
+        states->angle = 270;
+        break;
+    }
+  }
+  return(target);
+}
+
+
+void playback_free(struct playback *pb) {
+  if (pb == NULL) return;
+  free(pb->moves);
+  free(pb->history);
+  free(pb->keys);
+  free(pb->keyhist);
+  free(pb);
+}
@@ -0,0 +1,56 @@
+/*
+ * solution playback with keyframes, so any move of a replay can be reached fast.
+ *
+ * Copyright (C) 2014-2023 Mateusz Viste
+ *
+ * MIT License
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef PLAYBACK_H
+#define PLAYBACK_H
+
+#include <stddef.h> /* size_t */
+
+#include "sok_core.h"
+
+/* a board snapshot is recorded every PLAYBACK_KEYINTERVAL moves, which is
+ * the most moves a seek ever has to apply */
+#define PLAYBACK_KEYINTERVAL 64
+
+struct playback; /* opaque, a move string replayed on a given level */
+
+/* simulates moves (a LURD string) once on level and records keyframes along
+ * the way. characters that are not moves, and moves the board does not
+ * allow, are kept in the count but change nothing. returns NULL on
+ * allocation failure */
+struct playback *playback_new(const struct sokgame *level, const char *moves);
+
+/* returns the amount of moves of the replay */
+size_t playback_len(const struct playback *pb);
+
+/* sets game and states to how they are after the first target moves of the
+ * replay (target is clamped to playback_len()), starting from the closest
+ * keyframe. returns the position reached */
+size_t playback_seek(const struct playback *pb, struct sokgame *game, struct sokgamestates *states, size_t target);
+
+void playback_free(struct playback *pb);
+
+#endif
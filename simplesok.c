@@ -27,6 +27,7 @@
 #include <stdio.h>
 #include <stdlib.h>             /* malloc() */
 #include <string.h>             /* memcpy() */
+#include <ctype.h>              /* tolower() */
 #include <time.h>
 #include <SDL2/SDL.h>           /* SDL       */
 
@@ -35,7 +36,11 @@
 #include "save.h"
 #include "data.h"           /* embedded assets (font, levels...) */
 #include "gz.h"
+#include "httpcache.h"
 #include "net.h"
+#include "netjob.h"
+#include "perf.h"
+#include "playback.h"
 #include "skin.h"
 
 #define PVER "1.0.3"
@@ -44,6 +49,7 @@
 #define INET_HOST "simplesok.osdn.io"
 #define INET_PORT 80
 #define INET_PATH "/netlevels/"
+#define MIRROR_MAXCONN 4 /* transfers run at once by --mirror-netlevels */
 
 #define DEFAULT_SKIN "antique3"
 
@@ -68,9 +74,25 @@
 
 #define DRAWPLAYFIELDTILE_DRAWATOM 1
 #define DRAWPLAYFIELDTILE_PUSH 2
+#define DRAWPLAYFIELDTILE_ATOMABOVE 4 /* the cell's box will be drawn over it, at the same position */
+
+#define CELLPLAN_ATOM 1      /* plan_cell() flags */
+#define CELLPLAN_ATOMABOVE 2
+#define CELLPLAN_MAX 8       /* floor, goal, wall, 4 caps, box */
 
 #define BLIT_LEVELMAP_BACKGROUND 1
 
+#define ANIM_DONE 1000 /* animation progress is expressed in 1/1000th units */
+
+#define PLAYSPEED_MAX 1024    /* fastest turbo playback multiplier */
+#define PLAYSPEED_BASERATE 5  /* moves per second of a turbo playback at x1, close to an animated one */
+
+#define THUMBCACHE_SIZE 32    /* number of level thumbnails kept in cache */
+#define THUMBCACHE_PREFETCH 6 /* levels around the selection that are pre-rendered when idle */
+
+#define INPUTQUEUE_LEN 64     /* max number of input events waiting to be processed */
+#define INPUTQUEUE_SKIPANIM 3 /* animations are skipped when that many events are waiting */
+
 #define FONT_SPACE_WIDTH 12
 #define FONT_KERNING -3
 
@@ -109,6 +131,9 @@ enum normalizedkeys {
   KEY_R,
   KEY_CTRL_C,
   KEY_CTRL_V,
+  KEY_CTRL_Y,
+  KEY_PLUS,
+  KEY_MINUS,
   KEY_UNKNOWN
 };
 
@@ -123,9 +148,50 @@ struct videosettings {
   unsigned short tilesize;
   int framedelay;
   int framefreq;
+  int vsync;               /* non-zero if SDL_RenderPresent() is synced to the display refresh */
+  int perfoverlay;         /* non-zero if the performance overlay is displayed (toggled with F12) */
+  int playspeed;           /* solution playback speed multiplier, above 1 is turbo playback */
+  unsigned long playrate;  /* measured turbo playback speed, in moves per second */
   const char *customskinfile;
 };
 
+struct animation {
+  Uint64 start;     /* timestamp (us) when the animation started */
+  Uint64 duration;  /* duration of the animation (us) */
+};
+
+/* pacing of a turbo playback, where several moves are applied per frame */
+struct turbo {
+  Uint64 start;             /* timestamp (us) when pacing started, 0 to restart it */
+  unsigned long done;       /* moves applied since start */
+  Uint64 ratestart;         /* start of the current moves/s measurement */
+  unsigned long ratemoves;  /* moves applied since ratestart */
+};
+
+/* input events received while an animation is running, waiting to be processed */
+struct inputqueue {
+  SDL_Event events[INPUTQUEUE_LEN];
+  int head;  /* index of the oldest queued event */
+  int len;   /* number of events in the queue */
+};
+
+static struct inputqueue inputqueue;
+
+/* level thumbnails rendered into textures, keyed by (crc32, tilesize) */
+struct thumbcache_entry {
+  unsigned long crc32;
+  unsigned short tilesize;
+  unsigned long lastuse;   /* value of the cache clock when last used (LRU) */
+  SDL_Texture *texture;
+};
+
+struct thumbcache {
+  struct thumbcache_entry entries[THUMBCACHE_SIZE];
+  unsigned long clock;
+};
+
+static struct thumbcache thumbcache;
+
 /* returns the absolute value of the 'i' integer. */
 static int absval(int i) {
   if (i < 0) return(-i);
@@ -229,11 +295,65 @@ static int normalizekeys(SDL_Keycode key) {
     case SDLK_v:
       if (SDL_GetModState() & KMOD_CTRL) return(KEY_CTRL_V);
       break;
+    case SDLK_y:
+      if (SDL_GetModState() & KMOD_CTRL) return(KEY_CTRL_Y);
+      break;
+    case SDLK_PLUS:
+    case SDLK_EQUALS:
+    case SDLK_KP_PLUS:
+      return(KEY_PLUS);
+    case SDLK_MINUS:
+    case SDLK_KP_MINUS:
+      return(KEY_MINUS);
   }
   return(KEY_UNKNOWN);
 }
 
 
+/* returns non-zero if a keypress also types text, ie. it is followed by an
+ * SDL_TEXTINPUT event. this is the case of keypad digits while Num Lock is
+ * on, which normalizekeys() otherwise maps to arrows and such. */
+static int keytypestext(const SDL_Keysym *keysym) {
+  if (keysym->mod & KMOD_CTRL) return(0);
+  if ((keysym->sym >= 32) && (keysym->sym < 127)) return(1); /* printable ASCII */
+  switch (keysym->sym) {
+    case SDLK_KP_0:
+    case SDLK_KP_1:
+    case SDLK_KP_2:
+    case SDLK_KP_3:
+    case SDLK_KP_4:
+    case SDLK_KP_5:
+    case SDLK_KP_6:
+    case SDLK_KP_7:
+    case SDLK_KP_8:
+    case SDLK_KP_9:
+    case SDLK_KP_PERIOD:
+      return((keysym->mod & KMOD_NUM) != 0);
+  }
+  return(0);
+}
+
+
+/* returns the direction of a move from a solution string */
+static enum SOKMOVE playmovedir(char move) {
+  switch (move) {
+    case 'u':
+    case 'U':
+      return(sokmoveUP);
+    case 'r':
+    case 'R':
+      return(sokmoveRIGHT);
+    case 'd':
+    case 'D':
+      return(sokmoveDOWN);
+    case 'l':
+    case 'L':
+      return(sokmoveLEFT);
+  }
+  return(sokmoveNONE);
+}
+
+
 /* trims a trailing newline, if any, from a string */
 static void trimstr(char *str) {
   int x, lastrealchar = -1;
@@ -289,38 +409,128 @@ static int isLegalSokoSolution(char *solstr) {
   }
 }
 
-/* a wrapper on the SDL_Delay() call. The difference is that it reminds the last call, so it knows if there is still time to wait or not. This allows to smooth out delays, providing accurate delaying across platforms.
- * Usage: first call it with a '0' parameter to initialize the timer, and then feed it with t microseconds as many times as needed. */
-static int sokDelay(long t) {
-  static Uint32 timetowait = 0, starttime = 0, irq = 0, irqfreq = 0;
-  int res = 0;
-  Uint32 curtime = 0;
-  if (t <= 0) {
-    starttime = SDL_GetTicks();
-    timetowait = 0;
-    irq = 0;
-    irqfreq = (Uint32)(0 - t);
-    t = 0;
-  } else {
-    timetowait += t;
-    irq += t;
-    if (irq >= irqfreq) {
-      irq -= irqfreq;
-      res = 1;
-    }
+/* starts a time-based animation that will last for duration microseconds */
+static void anim_start(struct animation *anim, long duration) {
+  anim->start = perf_gettimeus();
+  if (duration < 1) duration = 1;
+  anim->duration = (Uint64)duration;
+}
+
+/* returns the progress of an animation, in the range 0..ANIM_DONE */
+static int anim_progress(const struct animation *anim) {
+  Uint64 elapsed = perf_gettimeus() - anim->start;
+  if (elapsed >= anim->duration) return(ANIM_DONE);
+  return((int)(elapsed * ANIM_DONE / anim->duration));
+}
+
+/* paces the rendering of animation frames. When the renderer is synced to
+ * the display refresh (vsync), SDL_RenderPresent() already blocks until the
+ * next frame, so there is nothing to do. Otherwise sleep (not spin) until
+ * framefreq microseconds have elapsed since the previous frame. */
+static void frame_wait(const struct videosettings *settings) {
+  static Uint64 lastframe = 0;
+  Uint64 now = perf_gettimeus();
+  if ((settings->vsync == 0) && (now - lastframe < (Uint64)settings->framefreq)) {
+    perf_zone_begin(PERF_WAIT);
+    SDL_Delay((Uint32)(((Uint64)settings->framefreq - (now - lastframe)) / 1000));
+    perf_zone_end(PERF_WAIT);
+    now = perf_gettimeus();
   }
-  for (;;) {
-    curtime = SDL_GetTicks();
-    if (starttime > curtime + 1000) break; /* the SDL_GetTicks() wraps after 49 days */
-    if (curtime - starttime >= timetowait / 1000) break;
-    SDL_Delay(1);
+  lastframe = now;
+}
+
+/* returns how many moves a turbo playback at speed playspeed should apply
+ * now to keep its pace. The pace restarts after a stall (slow frame, modal
+ * screen...) rather than catching up with a sudden burst of moves. */
+static unsigned long turbo_due(struct turbo *turbo, int playspeed) {
+  Uint64 now = perf_gettimeus();
+  Uint64 rate = (Uint64)PLAYSPEED_BASERATE * (Uint64)playspeed;
+  Uint64 due;
+  if (turbo->start == 0) {
+    turbo->start = now;
+    turbo->done = 0;
+    turbo->ratestart = now;
+    turbo->ratemoves = 0;
   }
-  return(res);
+  due = (now - turbo->start) * rate / 1000000 - turbo->done;
+  if (due > rate / 4 + 1) {
+    turbo->start = now;
+    turbo->done = 0;
+    due = 1;
+  }
+  return((unsigned long)due);
 }
 
+/* accounts for moves applied by a turbo playback and updates the measured
+ * playback speed about twice per second */
+static void turbo_applied(struct turbo *turbo, unsigned long moves, struct videosettings *settings) {
+  Uint64 now = perf_gettimeus();
+  turbo->done += moves;
+  turbo->ratemoves += moves;
+  if (now - turbo->ratestart >= 500000) {
+    settings->playrate = (unsigned long)((Uint64)turbo->ratemoves * 1000000 / (now - turbo->ratestart));
+    turbo->ratestart = now;
+    turbo->ratemoves = 0;
+  }
+}
+
+/* returns the number of input events waiting in the input queue */
+static int inputqueue_depth(void) {
+  return(inputqueue.len);
+}
+
+/* fetches pending keypresses, quit requests and dropped files without
+ * blocking and appends them to the input queue. This is called while
+ * animations run, so the game never misses keypresses and knows how much
+ * input is waiting. Any other event (window events, render target resets...)
+ * is left in SDL's queue, for the main loop to handle once it waits again. */
+static void inputqueue_pump(void) {
+  static const Uint32 queuedtypes[3] = {SDL_QUIT, SDL_KEYDOWN, SDL_DROPFILE};
+  SDL_Event event;
+  int i;
+  SDL_PumpEvents();
+  for (i = 0; i < 3; i++) {
+    while (SDL_PeepEvents(&event, 1, SDL_GETEVENT, queuedtypes[i], queuedtypes[i]) == 1) {
+      if (inputqueue.len >= INPUTQUEUE_LEN) {
+        /* queue full: drop the event, unless it is a QUIT request - this one
+         * replaces the most recent queued event so it is never lost */
+        if (event.type != SDL_QUIT) continue;
+        inputqueue.len -= 1;
+      }
+      inputqueue.events[(inputqueue.head + inputqueue.len) % INPUTQUEUE_LEN] = event;
+      inputqueue.len += 1;
+    }
+  }
+}
+
+/* pops the oldest event from the input queue. returns 0 if queue is empty, non-zero otherwise. */
+static int inputqueue_pop(SDL_Event *event) {
+  if (inputqueue.len == 0) return(0);
+  *event = inputqueue.events[inputqueue.head];
+  inputqueue.head = (inputqueue.head + 1) % INPUTQUEUE_LEN;
+  inputqueue.len -= 1;
+  return(1);
+}
+
+/* shortens an animation according to the amount of input waiting to be
+ * processed, so fast players are not lagging behind their own keypresses.
+ * returns non-zero if the animation should be skipped altogether. */
+static int anim_coalesce(struct animation *anim, long duration) {
+  int depth;
+  inputqueue_pump();
+  depth = inputqueue_depth();
+  if (depth >= INPUTQUEUE_SKIPANIM) return(1);
+  if (duration < 1) duration = 1;
+  anim->duration = (Uint64)duration / (Uint64)(depth + 1);
+  if (anim->duration < 1) anim->duration = 1;
+  return(0);
+}
+
+/* drops all pending events (both from SDL and from the input queue). returns 1 if a QUIT request was found. */
 static int flush_events(void) {
   SDL_Event event;
   int exitflag = 0;
+  while (inputqueue_pop(&event) != 0) if (event.type == SDL_QUIT) exitflag = 1;
   while (SDL_PollEvent(&event) != 0) if (event.type == SDL_QUIT) exitflag = 1;
   return(exitflag);
 }
@@ -396,6 +606,7 @@ static int displaytexture(SDL_Renderer *renderer, SDL_Texture *texture, SDL_Wind
   }
   SDL_SetTextureBlendMode(texture, SDL_BLENDMODE_BLEND);
   SDL_SetTextureAlphaMod(texture, alpha);
+  perf_drawcall(texture);
   if (SDL_RenderCopy(renderer, texture, NULL, rectptr) != 0) printf("SDL_RenderCopy() failed: %s\n", SDL_GetError());
   if ((flags & NOREFRESH) == 0) SDL_RenderPresent(renderer);
   if (timeout != 0) return(wait_for_a_key(timeout, renderer));
@@ -465,6 +676,16 @@ static void wordwrap(const char *string, char **multiline, int maxlines, int max
   }
 }
 
+/* returns the size of the area being drawn to: the window if there is one,
+ * otherwise the output of the (offscreen) renderer */
+static void get_drawarea(SDL_Renderer *renderer, SDL_Window *window, int *w, int *h) {
+  if (window != NULL) {
+    SDL_GetWindowSize(window, w, h);
+  } else {
+    SDL_GetRendererOutputSize(renderer, w, h);
+  }
+}
+
 /* blits a string onscreen, scaling the font at fontsize percents. The string is placed at starting position x/y */
 static void draw_string(const char *orgstring, int fontsize, unsigned char alpha, struct spritesstruct *sprites, SDL_Renderer *renderer, int x, int y, SDL_Window *window, int maxlines, int pheight) {
   int i, winw, winh;
@@ -475,7 +696,7 @@ static void draw_string(const char *orgstring, int fontsize, unsigned char alpha
   int multilineid = 0;
   if (maxlines > 16) maxlines = 16;
   /* get size of the window */
-  SDL_GetWindowSize(window, &winw, &winh);
+  get_drawarea(renderer, window, &winw, &winh);
   wordwrap(orgstring, multiline, maxlines, winw - x, fontsize, sprites);
   /* loop on every line */
   for (multilineid = 0; (multilineid < maxlines) && (multiline[multilineid] != NULL); multilineid += 1) {
@@ -503,6 +724,7 @@ static void draw_string(const char *orgstring, int fontsize, unsigned char alpha
       rectdst.w = rectsrc.w * fontsize / 100;
       rectdst.h = rectsrc.h * fontsize / 100;
       SDL_SetTextureAlphaMod(glyph, alpha);
+      perf_drawcall(glyph);
       SDL_RenderCopy(renderer, glyph, NULL, &rectdst);
       rectdst.x += (rectsrc.w * fontsize / 100) + (FONT_KERNING * fontsize / 100);
     }
@@ -512,6 +734,83 @@ static void draw_string(const char *orgstring, int fontsize, unsigned char alpha
 }
 
 
+/* draws the performance overlay: fps, frame time histogram, draw calls and timings of the last completed frame */
+static void draw_perfoverlay(SDL_Renderer *renderer, struct spritesstruct *sprites, SDL_Window *window) {
+  #define PERFHIST_BUCKETS 5
+  static const unsigned long limits[PERFHIST_BUCKETS] = {8334, 16667, 33334, 66667, 0};
+  static const char *labels[PERFHIST_BUCKETS] = {"8ms", "16ms", "33ms", "66ms", "more"};
+  unsigned int hist[PERFHIST_BUCKETS];
+  const struct perfframe *last = perf_lastframe();
+  char buff[64];
+  int i, winw, winh, lineh, y;
+  SDL_Rect rect;
+
+  perf_suspend(1); /* the overlay must not account for itself */
+  get_drawarea(renderer, window, &winw, &winh);
+  lineh = sprites->em * 60 / 100 + 2;
+
+  /* translucent background */
+  rect.w = 200;
+  rect.h = lineh * (8 + PERFHIST_BUCKETS) + 10;
+  rect.x = winw - rect.w - 5;
+  rect.y = 40;
+  SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_BLEND);
+  SDL_SetRenderDrawColor(renderer, 0, 0, 0, 200);
+  SDL_RenderFillRect(renderer, &rect);
+
+  y = rect.y + 5;
+  sprintf(buff, "fps: %u", perf_fps());
+  draw_string(buff, 60, 255, sprites, renderer, rect.x + 5, y, window, 1, 0);
+  y += lineh;
+  sprintf(buff, "frame: %lu.%lu ms", (unsigned long)(last->frametime / 1000), (unsigned long)(last->frametime % 1000 / 100));
+  draw_string(buff, 60, 255, sprites, renderer, rect.x + 5, y, window, 1, 0);
+  y += lineh;
+  sprintf(buff, "draw calls: %lu", last->drawcalls);
+  draw_string(buff, 60, 255, sprites, renderer, rect.x + 5, y, window, 1, 0);
+  y += lineh;
+  sprintf(buff, "textures bound: %lu", last->texbinds);
+  draw_string(buff, 60, 255, sprites, renderer, rect.x + 5, y, window, 1, 0);
+  y += lineh;
+  sprintf(buff, "draw: %lu.%lu ms", (unsigned long)(last->zonetime[PERF_DRAWSCREEN] / 1000), (unsigned long)(last->zonetime[PERF_DRAWSCREEN] % 1000 / 100));
+  draw_string(buff, 60, 255, sprites, renderer, rect.x + 5, y, window, 1, 0);
+  y += lineh;
+  sprintf(buff, "present: %lu.%lu ms", (unsigned long)(last->zonetime[PERF_PRESENT] / 1000), (unsigned long)(last->zonetime[PERF_PRESENT] % 1000 / 100));
+  draw_string(buff, 60, 255, sprites, renderer, rect.x + 5, y, window, 1, 0);
+  y += lineh;
+  sprintf(buff, "wait: %lu.%lu ms", (unsigned long)(last->zonetime[PERF_WAIT] / 1000), (unsigned long)(last->zonetime[PERF_WAIT] % 1000 / 100));
+  draw_string(buff, 60, 255, sprites, renderer, rect.x + 5, y, window, 1, 0);
+  y += lineh;
+  sprintf(buff, "queued input: %d", inputqueue_depth());
+  draw_string(buff, 60, 255, sprites, renderer, rect.x + 5, y, window, 1, 0);
+  y += lineh;
+
+  /* frame time histogram over the last PERF_HISTORY frames */
+  perf_histogram(hist, limits, PERFHIST_BUCKETS);
+  SDL_SetRenderDrawColor(renderer, 0x40, 0xC0, 0x40, 255);
+  for (i = 0; i < PERFHIST_BUCKETS; i++) {
+    SDL_Rect bar;
+    draw_string(labels[i], 60, 255, sprites, renderer, rect.x + 5, y, window, 1, 0);
+    bar.x = rect.x + 50;
+    bar.y = y + 2;
+    bar.w = (int)(hist[i] * (unsigned)(rect.w - 55) / PERF_HISTORY);
+    bar.h = lineh - 4;
+    if (bar.w > 0) SDL_RenderFillRect(renderer, &bar);
+    y += lineh;
+  }
+  SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
+  perf_suspend(0);
+}
+
+/* pushes the rendered frame to screen, drawing the performance overlay
+ * first if enabled, and closes the frame's statistics */
+static void render_present(SDL_Renderer *renderer, struct spritesstruct *sprites, SDL_Window *window, const struct videosettings *settings) {
+  if (settings->perfoverlay != 0) draw_perfoverlay(renderer, sprites, window);
+  perf_zone_begin(PERF_PRESENT);
+  SDL_RenderPresent(renderer);
+  perf_zone_end(PERF_PRESENT);
+  perf_endframe();
+}
+
 static int wallcap_isneeded(struct sokgame *game, int x, int y, int corner) {
   switch (corner) {
     case 0: /* top left corner */
@@ -542,25 +841,70 @@ static unsigned short getwallid(struct sokgame *game, int x, int y) {
 }
 
 
-static void draw_playfield_tile(struct sokgame *game, int x, int y, struct spritesstruct *sprites, SDL_Renderer *renderer, int winw, int winh, struct videosettings *settings, int flags, int moveoffsetx, int moveoffsety) {
+/* returns non-zero if sprite id of the skin is fully opaque (resp. fully transparent) */
+static int sprite_isopaque(const struct spritesstruct *sprites, unsigned short id) {
+  return((id < sprites->tilescount) && (sprites->tileinfo[id].opaque != 0));
+}
+
+static int sprite_isempty(const struct spritesstruct *sprites, unsigned short id) {
+  return((id < sprites->tilescount) && (sprites->tileinfo[id].empty != 0));
+}
+
+
+/* computes the minimal ordered list of sprites (bottom first) to draw on cell
+ * x/y: floor, goal, wall and wall caps, plus the box if flags contain
+ * CELLPLAN_ATOM. with CELLPLAN_ATOMABOVE the box is left out of the list, but
+ * it is known to be drawn later at the same position so whatever it hides is
+ * skipped. sprites that are empty or hidden by an opaque sprite above them
+ * are dropped. returns the number of sprites stored in plan */
+static int plan_cell(struct sokgame *game, int x, int y, const struct spritesstruct *sprites, int flags, unsigned short *plan) {
+  int i, count = 0, first, result = 0, atom = 0;
+  unsigned short cell = game->field[x][y];
+
+  /* build the complete list first */
+  if (cell & field_floor) plan[count++] = SPRITE_FLOOR;
+  if (cell & field_goal) plan[count++] = SPRITE_GOAL;
+  if (cell & field_wall) {
+    plan[count++] = SPRITE_WALL0 + getwallid(game, x, y);
+    for (i = 0; i < 4; i++) {
+      if (wallcap_isneeded(game, x, y, i)) plan[count++] = SPRITE_WALLCR + i;
+    }
+  }
+  if ((flags & (CELLPLAN_ATOM | CELLPLAN_ATOMABOVE)) && (cell & field_atom)) {
+    plan[count++] = (cell & field_goal) ? SPRITE_BOXOK : SPRITE_BOX;
+    atom = 1;
+  }
+
+  /* anything below the topmost opaque sprite will never be seen */
+  for (first = count - 1; first > 0; first--) {
+    if (sprite_isopaque(sprites, plan[first])) break;
+  }
+  if (first < 0) first = 0;
+
+  /* keep what is left, minus empty sprites and the box if drawn later */
+  for (i = first; i < count; i++) {
+    if (sprite_isempty(sprites, plan[i])) continue;
+    if ((atom != 0) && (i == count - 1) && (flags & CELLPLAN_ATOMABOVE)) continue;
+    plan[result++] = plan[i];
+  }
+  return(result);
+}
+
+
+/* draws a single playfield tile. originx/originy are the pixel coordinates of the playfield's top left corner */
+static void draw_playfield_tile(struct sokgame *game, int x, int y, struct spritesstruct *sprites, SDL_Renderer *renderer, int originx, int originy, struct videosettings *settings, int flags, int moveoffsetx, int moveoffsety) {
   int xpix, ypix;
   /* compute the pixel coordinates of the destination field */
-  xpix = getoffseth(game, winw, settings->tilesize) + (x * settings->tilesize) + moveoffsetx;
-  ypix = getoffsetv(game, winh, settings->tilesize) + (y * settings->tilesize) + moveoffsety;
+  xpix = originx + (x * settings->tilesize) + moveoffsetx;
+  ypix = originy + (y * settings->tilesize) + moveoffsety;
 
   if ((flags & DRAWPLAYFIELDTILE_DRAWATOM) == 0) {
-    if (game->field[x][y] & field_floor) gra_rendertile(renderer, sprites, SPRITE_FLOOR, xpix, ypix, settings->tilesize, 0);
-    if (game->field[x][y] & field_goal) gra_rendertile(renderer, sprites, SPRITE_GOAL, xpix, ypix, settings->tilesize, 0);
-    if (game->field[x][y] & field_wall) {
-      unsigned short i;
-      gra_rendertile(renderer, sprites, SPRITE_WALL0 + getwallid(game, x, y), xpix, ypix, settings->tilesize, 0);
-      /* draw the wall element (in 4 times, to draw caps when necessary) */
-      for (i = 0; i < 4; i++) {
-        if (wallcap_isneeded(game, x, y, i)) {
-          gra_rendertile(renderer, sprites, SPRITE_WALLCR + i, xpix, ypix, settings->tilesize, 0);
-        }
-      }
-    }
+    unsigned short plan[CELLPLAN_MAX];
+    int i, count;
+    /* floor, goal, wall and wall caps. the box itself is drawn in a later
+     * pass, but when it does not move it may hide what lies below */
+    count = plan_cell(game, x, y, sprites, (flags & DRAWPLAYFIELDTILE_ATOMABOVE) ? CELLPLAN_ATOMABOVE : 0, plan);
+    for (i = 0; i < count; i++) gra_rendertile(renderer, sprites, plan[i], xpix, ypix, settings->tilesize, 0);
   } else if (game->field[x][y] & field_atom) {
     unsigned short boxsprite = SPRITE_BOX;
     if (game->field[x][y] & field_goal) {
@@ -589,14 +933,27 @@ static void draw_player(struct sokgame *game, struct sokgamestates *states, stru
 }
 
 
+/* computes the range of cells [*first..*last[ of a playfield axis that are
+ * (at least partially) visible in a window of winsize pixels, origin being
+ * the pixel position of cell 0. A margin of one cell is kept on both sides,
+ * so tiles shifted by a move animation are never culled too early. */
+static void visiblecells(int origin, int tilesize, int winsize, int fieldsize, int *first, int *last) {
+  *first = (0 - origin) / tilesize - 1;
+  *last = (winsize - origin) / tilesize + 2;
+  if (*first < 0) *first = 0;
+  if (*last > fieldsize) *last = fieldsize;
+}
+
 static void draw_screen(struct sokgame *game, struct sokgamestates *states, struct spritesstruct *sprites, SDL_Renderer *renderer, SDL_Window *window, struct videosettings *settings, int moveoffsetx, int moveoffsety, int scrolling, int flags, char *levelname) {
   int x, y, winw, winh, offx, offy;
+  int originx, originy, firstx, lastx, firsty, lasty, pushedx, pushedy;
   /* int partialoffsetx = 0, partialoffsety = 0; */
   char stringbuff[256];
   int scrollingadjx = 0, scrollingadjy = 0; /* this is used when scrolling + movement of player is needed */
   int drawtile_flags = 0;
 
-  SDL_GetWindowSize(window, &winw, &winh);
+  perf_zone_begin(PERF_DRAWSCREEN);
+  get_drawarea(renderer, window, &winw, &winh);
   SDL_RenderClear(renderer);
 
   if ((flags & DRAWSCREEN_NOBG) == 0) {
@@ -623,19 +980,33 @@ static void draw_screen(struct sokgame *game, struct sokgamestates *states, stru
       moveoffsety = -scrolling;
     }
   }
+  /* compute the position of the playfield and the range of cells that land on screen */
+  originx = getoffseth(game, winw, settings->tilesize);
+  originy = getoffsetv(game, winh, settings->tilesize);
+  visiblecells(originx - ((scrolling != 0) ? moveoffsetx : 0), settings->tilesize, winw, game->field_width, &firstx, &lastx);
+  visiblecells(originy - ((scrolling != 0) ? moveoffsety : 0), settings->tilesize, winh, game->field_height, &firsty, &lasty);
+  /* the box being pushed (if any) is the only one not aligned with its cell */
+  pushedx = game->positionx;
+  pushedy = game->positiony;
+  if (moveoffsetx > 0) pushedx += 1;
+  if (moveoffsetx < 0) pushedx -= 1;
+  if (moveoffsety > 0) pushedy += 1;
+  if (moveoffsety < 0) pushedy -= 1;
   /* draw non-moveable tiles (floors, walls, goals) */
-  for (y = 0; y < game->field_height; y++) {
-    for (x = 0; x < game->field_width; x++) {
+  for (y = firsty; y < lasty; y++) {
+    for (x = firstx; x < lastx; x++) {
+      int tileflags = drawtile_flags;
+      if ((x != pushedx) || (y != pushedy)) tileflags |= DRAWPLAYFIELDTILE_ATOMABOVE;
       if (scrolling != 0) {
-        draw_playfield_tile(game, x, y, sprites, renderer, winw, winh, settings, drawtile_flags, -moveoffsetx, -moveoffsety);
+        draw_playfield_tile(game, x, y, sprites, renderer, originx, originy, settings, tileflags, -moveoffsetx, -moveoffsety);
       } else {
-        draw_playfield_tile(game, x, y, sprites, renderer, winw, winh, settings, drawtile_flags, 0, 0);
+        draw_playfield_tile(game, x, y, sprites, renderer, originx, originy, settings, tileflags, 0, 0);
       }
     }
   }
   /* draw moveable elements (atoms) */
-  for (y = 0; y < game->field_height; y++) {
-    for (x = 0; x < game->field_width; x++) {
+  for (y = firsty; y < lasty; y++) {
+    for (x = firstx; x < lastx; x++) {
       offx = 0;
       offy = 0;
       if (scrolling == 0) {
@@ -651,7 +1022,7 @@ static void draw_screen(struct sokgame *game, struct sokgamestates *states, stru
         if ((moveoffsety > 0) && (y == game->positiony + 1) && (x == game->positionx)) offy = scrollingadjy;
         if ((moveoffsety < 0) && (y == game->positiony - 1) && (x == game->positionx)) offy = scrollingadjy;
       }
-      draw_playfield_tile(game, x, y, sprites, renderer, winw, winh, settings, DRAWPLAYFIELDTILE_DRAWATOM, offx, offy);
+      draw_playfield_tile(game, x, y, sprites, renderer, originx, originy, settings, DRAWPLAYFIELDTILE_DRAWATOM, offx, offy);
     }
   }
   /* draw where the player is */
@@ -670,18 +1041,24 @@ static void draw_screen(struct sokgame *game, struct sokgamestates *states, stru
       sprintf(stringbuff, "best score: -");
     }
     draw_string(stringbuff, 100, 255, sprites, renderer, DRAWSTRING_RIGHT, 0, window, 1, 0);
-    sprintf(stringbuff, "moves: %lu / pushes: %lu", (unsigned long)sok_history_getlen(states->history), (unsigned long)sok_history_getpushes(states->history));
+    sprintf(stringbuff, "moves: %lu / pushes: %lu", (unsigned long)states->historylen, (unsigned long)states->pushes);
     draw_string(stringbuff, 100, 255, sprites, renderer, 10, 0, window, 1, 0);
   }
-  if ((flags & DRAWSCREEN_PLAYBACK) && (time(NULL) % 2 == 0)) draw_string("*** PLAYBACK ***", 100, 255, sprites, renderer, DRAWSTRING_CENTER, 32, window, 1, 0);
+  if ((flags & DRAWSCREEN_PLAYBACK) && (settings->playspeed > 1)) {
+    sprintf(stringbuff, "*** PLAYBACK x%d - %lu moves/s ***", settings->playspeed, settings->playrate);
+    draw_string(stringbuff, 100, 255, sprites, renderer, DRAWSTRING_CENTER, 32, window, 1, 0);
+  } else if ((flags & DRAWSCREEN_PLAYBACK) && (time(NULL) % 2 == 0)) {
+    draw_string("*** PLAYBACK ***", 100, 255, sprites, renderer, DRAWSTRING_CENTER, 32, window, 1, 0);
+  }
+  perf_zone_end(PERF_DRAWSCREEN);
   /* Update the screen */
-  if (flags & DRAWSCREEN_REFRESH) SDL_RenderPresent(renderer);
+  if (flags & DRAWSCREEN_REFRESH) render_present(renderer, sprites, window, settings);
 }
 
 static int rotatePlayer(struct spritesstruct *sprites, struct sokgame *game, struct sokgamestates *states, enum SOKMOVE dir, SDL_Renderer *renderer, SDL_Window *window, struct videosettings *settings, char *levelname, int drawscreenflags) {
   int srcangle = states->angle;
-  int dstangle, dirmotion, winw, winh;
-  SDL_GetWindowSize(window, &winw, &winh);
+  int dstangle, dirmotion;
+  struct animation anim;
   switch (dir) {
     case sokmoveNONE:
     case sokmoveUP:
@@ -699,7 +1076,7 @@ static int rotatePlayer(struct spritesstruct *sprites, struct sokgame *game, str
   }
   /* figure out how to compute the shortest way to rotate the player... This is not a very efficient way, but it works.. I might improve it in the future... */
   if (srcangle != dstangle) {
-    int tmpangle, stepsright = 0, stepsleft = 0;
+    int tmpangle, stepsright = 0, stepsleft = 0, quarterturns;
     for (tmpangle = srcangle; ; tmpangle += 90) {
       if (tmpangle >= 360) tmpangle -= 360;
       stepsright += 1;
@@ -721,17 +1098,22 @@ static int rotatePlayer(struct spritesstruct *sprites, struct sokgame *game, str
         dirmotion = 1;
       }
     }
-    /* perform the rotation */
-    sokDelay(0 - settings->framefreq); /* init my delay timer */
-    for (tmpangle = srcangle; ; tmpangle += dirmotion) {
-      if (tmpangle >= 360) tmpangle = 0;
-      if (tmpangle < 0) tmpangle = 359;
+    /* perform the rotation - a 90 degrees turn lasts (framedelay * 90 / 8) us */
+    quarterturns = ((stepsleft < stepsright) ? stepsleft : stepsright) - 1;
+    anim_start(&anim, (long)settings->framedelay * 90 / 8 * quarterturns);
+    for (;;) {
+      int progress;
+      if (anim_coalesce(&anim, (long)settings->framedelay * 90 / 8 * quarterturns) != 0) break;
+      progress = anim_progress(&anim);
+      tmpangle = srcangle + dirmotion * quarterturns * 90 * progress / ANIM_DONE;
+      while (tmpangle >= 360) tmpangle -= 360;
+      while (tmpangle < 0) tmpangle += 360;
       states->angle = tmpangle;
-      if (sokDelay(settings->framedelay / 8)) { /* wait for x ms */
-        draw_screen(game, states, sprites, renderer, window, settings, 0, 0, 0, DRAWSCREEN_REFRESH | drawscreenflags, levelname);
-      }
-      if (tmpangle == dstangle) break;
+      draw_screen(game, states, sprites, renderer, window, settings, 0, 0, 0, DRAWSCREEN_REFRESH | drawscreenflags, levelname);
+      if (progress >= ANIM_DONE) break;
+      frame_wait(settings);
     }
+    states->angle = dstangle;
     return(1);
   }
   return(0);
@@ -794,7 +1176,7 @@ static unsigned char *selectgametype(SDL_Renderer *renderer, struct spritesstruc
   }
 
   for (;;) {
-    int refreshnow = 1;
+    struct animation anim;
     /* get windows x / y size */
     SDL_GetWindowSize(window, &winw, &winh);
 
@@ -811,53 +1193,47 @@ static unsigned char *selectgametype(SDL_Renderer *renderer, struct spritesstruc
     rect.x = ((winw - longeststringw) >> 1) - 54;
     newpusherposy = selectionpos[selection] + 25 - (rect.h / 2);
     if (selectionchangeflag == 0) oldpusherposy = newpusherposy;
-    /* draw the screen */
+    /* draw the screen - the pusher travels one pixel per (framedelay / 4) us */
     rect.y = oldpusherposy;
-    sokDelay(0 - settings->framefreq); /* init my delay timer */
+    anim_start(&anim, (long)absval(newpusherposy - oldpusherposy) * (settings->framedelay / 4));
     for (;;) {
-      if (refreshnow) { /* wait for x ms */
-        SDL_RenderClear(renderer);
-        gra_renderbg(renderer, sprites, SPRITE_BG, settings->tilesize, winw, winh);
-        { /* render title, version and copyright string */
-          int sokow, sokoh, simpw, simph, verw, verh, copyw, copyh;
-          int tity;
-          const char *simpstr = "simple";
-          const char *sokostr = "SOKOBAN";
-          const char *verstr = "ver " PVER;
-          const char *copystr = "Copyright (C) " PDATE " Mateusz Viste";
-
-          get_string_size(simpstr, 100, sprites, &simpw, &simph);
-          get_string_size(sokostr, 300, sprites, &sokow, &sokoh);
-          get_string_size(verstr, 100, sprites, &verw, &verh);
-          get_string_size(copystr, 60, sprites, &copyw, &copyh);
-
-          tity = (selectionpos[0] - (sokoh * 8 / 10)) / 2 - (simph * 8 / 10);
-
-          draw_string(simpstr, 100, 200, sprites, renderer, 10 + (winw - sokow) / 2, tity, window, 1, 0);
-          tity += simph * 8 / 10;
-          draw_string(sokostr, 300, 255, sprites, renderer, (winw - sokow) / 2, tity, window, 1, 0);
-          tity += sokoh * 8 / 10;
-          draw_string(verstr, 100, 180, sprites, renderer, (sokow + (winw - sokow) / 2) - verw, tity, window, 1, 0);
-
-          /* copyright string */
-          draw_string(copystr, 60, 200, sprites, renderer, winw - (copyw + 5), winh - copyh, window, 1, 0);
-        }
-
-        gra_rendertile(renderer, sprites, sprites->playerid, rect.x, rect.y, settings->tilesize, 90);
-        for (x = 0; x < 5; x++) {
-          draw_string(levname[x], 100, 255, sprites, renderer, rect.x + 54, textvadj + selectionpos[x], window, 1, 0);
-        }
-        SDL_RenderPresent(renderer);
-        if (rect.y == newpusherposy) break;
+      rect.y = oldpusherposy + (newpusherposy - oldpusherposy) * anim_progress(&anim) / ANIM_DONE;
+      perf_zone_begin(PERF_DRAWSCREEN);
+      SDL_RenderClear(renderer);
+      gra_renderbg(renderer, sprites, SPRITE_BG, settings->tilesize, winw, winh);
+      { /* render title, version and copyright string */
+        int sokow, sokoh, simpw, simph, verw, verh, copyw, copyh;
+        int tity;
+        const char *simpstr = "simple";
+        const char *sokostr = "SOKOBAN";
+        const char *verstr = "ver " PVER;
+        const char *copystr = "Copyright (C) " PDATE " Mateusz Viste";
+
+        get_string_size(simpstr, 100, sprites, &simpw, &simph);
+        get_string_size(sokostr, 300, sprites, &sokow, &sokoh);
+        get_string_size(verstr, 100, sprites, &verw, &verh);
+        get_string_size(copystr, 60, sprites, &copyw, &copyh);
+
+        tity = (selectionpos[0] - (sokoh * 8 / 10)) / 2 - (simph * 8 / 10);
+
+        draw_string(simpstr, 100, 200, sprites, renderer, 10 + (winw - sokow) / 2, tity, window, 1, 0);
+        tity += simph * 8 / 10;
+        draw_string(sokostr, 300, 255, sprites, renderer, (winw - sokow) / 2, tity, window, 1, 0);
+        tity += sokoh * 8 / 10;
+        draw_string(verstr, 100, 180, sprites, renderer, (sokow + (winw - sokow) / 2) - verw, tity, window, 1, 0);
+
+        /* copyright string */
+        draw_string(copystr, 60, 200, sprites, renderer, winw - (copyw + 5), winh - copyh, window, 1, 0);
       }
-      if (newpusherposy < oldpusherposy) {
-        rect.y -= 1;
-        if (rect.y < newpusherposy) rect.y = newpusherposy;
-      } else {
-        rect.y += 1;
-        if (rect.y > newpusherposy) rect.y = newpusherposy;
+
+      gra_rendertile(renderer, sprites, sprites->playerid, rect.x, rect.y, settings->tilesize, 90);
+      for (x = 0; x < 5; x++) {
+        draw_string(levname[x], 100, 255, sprites, renderer, rect.x + 54, textvadj + selectionpos[x], window, 1, 0);
       }
-      refreshnow = sokDelay(settings->framedelay / 4);
+      perf_zone_end(PERF_DRAWSCREEN);
+      render_present(renderer, sprites, window, settings);
+      if (rect.y == newpusherposy) break;
+      frame_wait(settings);
     }
     oldpusherposy = newpusherposy;
     selectionchangeflag = 0;
@@ -868,6 +1244,8 @@ static unsigned char *selectgametype(SDL_Renderer *renderer, struct spritesstruc
     /* check what event we got */
     if (event.type == SDL_QUIT) {
       return(NULL);
+    } else if ((event.type == SDL_RENDER_TARGETS_RESET) || (event.type == SDL_RENDER_DEVICE_RESET)) {
+      gra_flushcache(sprites); /* content of target textures is lost */
     } else if (event.type == SDL_DROPFILE) {
       if (processDropFileEvent(&event, levelfile) != NULL) return(NULL);
     } else if (event.type == SDL_KEYDOWN) {
@@ -888,6 +1266,9 @@ static unsigned char *selectgametype(SDL_Renderer *renderer, struct spritesstruc
         case KEY_FULLSCREEN:
           switchfullscreen(window);
           break;
+        case KEY_F12:
+          settings->perfoverlay ^= 1;
+          break;
         case KEY_ESCAPE:
           return(NULL);
       }
@@ -898,10 +1279,98 @@ static unsigned char *selectgametype(SDL_Renderer *renderer, struct spritesstruc
 }
 
 
+/* draws the tiles of a level map, with its top left corner at xpos/ypos */
+static void draw_levelmap_tiles(struct sokgame *game, struct spritesstruct *sprites, int xpos, int ypos, SDL_Renderer *renderer, unsigned short tilesize) {
+  unsigned short plan[CELLPLAN_MAX];
+  int x, y, i, count;
+  SDL_Rect rect;
+  for (y = 0; y < game->field_height; y++) {
+    for (x = 0; x < game->field_width; x++) {
+      /* compute coordinates of the tile on screen */
+      rect.x = xpos + (tilesize * x);
+      rect.y = ypos + (tilesize * y);
+      /* draw the tile */
+      count = plan_cell(game, x, y, sprites, CELLPLAN_ATOM, plan);
+      for (i = 0; i < count; i++) gra_rendertile(renderer, sprites, plan[i], rect.x, rect.y, tilesize, 0);
+    }
+  }
+}
+
+/* drops all cached level thumbnails */
+static void thumbcache_flush(void) {
+  int i;
+  for (i = 0; i < THUMBCACHE_SIZE; i++) {
+    if (thumbcache.entries[i].texture != NULL) SDL_DestroyTexture(thumbcache.entries[i].texture);
+  }
+  memset(&thumbcache, 0, sizeof(thumbcache));
+}
+
+/* returns the cache slot of a level thumbnail, or NULL if not cached yet */
+static struct thumbcache_entry *thumbcache_find(const struct sokgame *game, unsigned short tilesize) {
+  int i;
+  for (i = 0; i < THUMBCACHE_SIZE; i++) {
+    struct thumbcache_entry *e = &(thumbcache.entries[i]);
+    if ((e->texture != NULL) && (e->crc32 == game->crc32) && (e->tilesize == tilesize)) return(e);
+  }
+  return(NULL);
+}
+
+/* returns a texture with the level map of game rendered at tilesize. The
+ * texture is rendered once and then kept in a LRU cache. Returns NULL if
+ * the renderer is not able to render to textures. */
+static SDL_Texture *thumbcache_get(SDL_Renderer *renderer, struct spritesstruct *sprites, struct sokgame *game, unsigned short tilesize) {
+  struct thumbcache_entry *e;
+  SDL_Texture *prevtarget;
+  int i;
+
+  if (tilesize == 0) return(NULL);
+  thumbcache.clock += 1;
+
+  /* cache hit? */
+  e = thumbcache_find(game, tilesize);
+  if (e != NULL) {
+    e->lastuse = thumbcache.clock;
+    return(e->texture);
+  }
+
+  if (SDL_RenderTargetSupported(renderer) == SDL_FALSE) return(NULL);
+
+  /* pick a free slot, or evict the least recently used thumbnail */
+  e = &(thumbcache.entries[0]);
+  for (i = 0; i < THUMBCACHE_SIZE; i++) {
+    if (thumbcache.entries[i].texture == NULL) {
+      e = &(thumbcache.entries[i]);
+      break;
+    }
+    if (thumbcache.entries[i].lastuse < e->lastuse) e = &(thumbcache.entries[i]);
+  }
+  if (e->texture != NULL) SDL_DestroyTexture(e->texture);
+  memset(e, 0, sizeof(*e));
+
+  e->texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_TARGET, game->field_width * tilesize, game->field_height * tilesize);
+  if (e->texture == NULL) return(NULL);
+  SDL_SetTextureBlendMode(e->texture, SDL_BLENDMODE_BLEND);
+
+  /* render the level map into the texture */
+  prevtarget = SDL_GetRenderTarget(renderer);
+  SDL_SetRenderTarget(renderer, e->texture);
+  SDL_SetRenderDrawColor(renderer, 0, 0, 0, 0);
+  SDL_RenderClear(renderer);
+  SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
+  draw_levelmap_tiles(game, sprites, 0, 0, renderer, tilesize);
+  SDL_SetRenderTarget(renderer, prevtarget);
+
+  e->crc32 = game->crc32;
+  e->tilesize = tilesize;
+  e->lastuse = thumbcache.clock;
+  return(e->texture);
+}
+
 /* blit a level preview */
 static void blit_levelmap(struct sokgame *game, struct spritesstruct *sprites, int xpos, int ypos, SDL_Renderer *renderer, unsigned short tilesize, unsigned char alpha, int flags) {
-  int x, y, bgpadding = tilesize * 3;
+  int bgpadding = tilesize * 3;
   SDL_Rect rect, bgrect;
+  SDL_Texture *thumb;
 
   bgrect.x = xpos - (game->field_width * tilesize + bgpadding) / 2;
   bgrect.y = ypos - (game->field_height * tilesize + bgpadding) / 2;
@@ -910,43 +1379,32 @@ static void blit_levelmap(struct sokgame *game, struct spritesstruct *sprites, i
   /* if background enabled, compute coordinates of the background and draw it */
   if (flags & BLIT_LEVELMAP_BACKGROUND) {
     SDL_SetRenderDrawColor(renderer, 0x12, 0x12, 0x12, 255);
+    perf_drawcall(NULL);
     SDL_RenderFillRect(renderer, &bgrect);
     SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
   }
-  for (y = 0; y < game->field_height; y++) {
-    for (x = 0; x < game->field_width; x++) {
-      /* compute coordinates of the tile on screen */
-      rect.x = xpos + (tilesize * x) - (game->field_width * tilesize) / 2;
-      rect.y = ypos + (tilesize * y) - (game->field_height * tilesize) / 2;
-      /* draw the tile */
-      if (game->field[x][y] & field_floor) gra_rendertile(renderer, sprites, SPRITE_FLOOR, rect.x, rect.y, tilesize, 0);
-      if (game->field[x][y] & field_wall) {
-        unsigned short i;
-        gra_rendertile(renderer, sprites, SPRITE_WALL0 + getwallid(game, x, y), rect.x, rect.y, tilesize, 0);
-        /* check for neighbors and draw wall cap if needed */
-        for (i = 0; i < 4; i++) {
-          if (wallcap_isneeded(game, x, y, i)) {
-            gra_rendertile(renderer, sprites, SPRITE_WALLCR + i, rect.x, rect.y, tilesize, 0);
-          }
-        }
-      }
-      if ((game->field[x][y] & field_goal) && (game->field[x][y] & field_atom)) { /* atom on goal */
-        gra_rendertile(renderer, sprites, SPRITE_BOXOK, rect.x, rect.y, tilesize, 0);
-      } else if (game->field[x][y] & field_goal) { /* goal */
-        gra_rendertile(renderer, sprites, SPRITE_GOAL, rect.x, rect.y, tilesize, 0);
-      } else if (game->field[x][y] & field_atom) { /* atom */
-        gra_rendertile(renderer, sprites, SPRITE_BOX, rect.x, rect.y, tilesize, 0);
-      }
-    }
+  /* draw the level map, from the thumbnails cache if possible */
+  rect.x = xpos - (game->field_width * tilesize) / 2;
+  rect.y = ypos - (game->field_height * tilesize) / 2;
+  thumb = thumbcache_get(renderer, sprites, game, tilesize);
+  if (thumb != NULL) {
+    rect.w = game->field_width * tilesize;
+    rect.h = game->field_height * tilesize;
+    perf_drawcall(thumb);
+    SDL_RenderCopy(renderer, thumb, NULL, &rect);
+  } else {
+    draw_levelmap_tiles(game, sprites, rect.x, rect.y, renderer, tilesize);
   }
   /* apply alpha filter */
   SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_BLEND);
   SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255 - alpha);
+  perf_drawcall(NULL);
   SDL_RenderFillRect(renderer, &bgrect);
   /* if background enabled, then draw the border */
   if (flags & BLIT_LEVELMAP_BACKGROUND) {
     unsigned char fadealpha;
     SDL_SetRenderDrawColor(renderer, 0x28, 0x28, 0x28, 255);
+    perf_drawcall(NULL);
     SDL_RenderDrawRect(renderer, &bgrect);
     /* draw a nice fade-out effect around the selected level */
     for (fadealpha = 1; fadealpha < 20; fadealpha++) {
@@ -955,6 +1413,7 @@ static void blit_levelmap(struct sokgame *game, struct spritesstruct *sprites, i
       bgrect.y -= 1;
       bgrect.w += 2;
       bgrect.h += 2;
+      perf_drawcall(NULL);
       SDL_RenderDrawRect(renderer, &bgrect);
     }
     /* set the drawing color to its default, plain black color */
@@ -968,29 +1427,55 @@ static void blit_levelmap(struct sokgame *game, struct spritesstruct *sprites, i
     rect.h = rect.h * sprites->em / 60;
     rect.x = xpos - (rect.w / 2);
     rect.y = ypos - (rect.h * 3 / 4);
+    perf_drawcall(sprites->solved);
     SDL_RenderCopy(renderer, sprites->solved, NULL, &rect);
   }
 }
 
-static int fade2texture(SDL_Renderer *renderer, SDL_Window *window, SDL_Texture *texture) {
-  int exitflag = 0;
-  unsigned char alphaval;
-  sokDelay(0);  /* init my delay timer */
-  for (alphaval = 0; alphaval < 64; alphaval += 4) {
-    exitflag = displaytexture(renderer, texture, window, 0, 0, alphaval);
-    if (exitflag != 0) break;
-    sokDelay(15 * 1000);  /* wait for 15ms */
+static int fade2texture(SDL_Renderer *renderer, SDL_Window *window, SDL_Texture *texture, const struct videosettings *settings) {
+  int exitflag = 0, step, laststep = -1;
+  struct animation anim;
+  /* the fade is made of 16 cumulative steps, spread over 240ms */
+  anim_start(&anim, 240 * 1000L);
+  for (;;) {
+    step = anim_progress(&anim) * 16 / ANIM_DONE;
+    if (step >= 16) break;
+    if (step != laststep) {
+      exitflag = displaytexture(renderer, texture, window, 0, 0, (unsigned char)(step * 4));
+      if (exitflag != 0) break;
+      laststep = step;
+    }
+    frame_wait(settings);
   }
   if (exitflag == 0) exitflag = displaytexture(renderer, texture, window, 0, 0, 255);
   return(exitflag);
 }
 
-static int selectlevel(struct sokgame **gameslist, struct spritesstruct *sprites, SDL_Renderer *renderer, SDL_Window *window, struct videosettings *settings, char *levcomment, int levelscount, int selection, char **levelfile) {
+/* pre-renders the thumbnail of one level around the selection (nearest levels
+ * first) at the zoom levels used by the level selection screen. returns 0 if
+ * there was nothing left to prefetch, non-zero otherwise. */
+static int thumbcache_prefetch(SDL_Renderer *renderer, struct spritesstruct *sprites, struct sokgame **gameslist, int selection, int maxallowedlevel, unsigned short tilesize) {
+  int dist, lev;
+  for (dist = 0; dist <= THUMBCACHE_PREFETCH * 2; dist++) {
+    /* 0, +1, -1, +2, -2, ... */
+    lev = selection + ((dist & 1) ? (dist + 1) / 2 : -(dist / 2));
+    if ((lev < 0) || (lev >= maxallowedlevel)) continue;
+    if (thumbcache_find(gameslist[lev], tilesize / 3) == NULL) {
+      return(thumbcache_get(renderer, sprites, gameslist[lev], tilesize / 3) != NULL);
+    }
+    if (thumbcache_find(gameslist[lev], tilesize / 4) == NULL) {
+      return(thumbcache_get(renderer, sprites, gameslist[lev], tilesize / 4) != NULL);
+    }
+  }
+  return(0);
+}
+
+static int selectlevel(struct sokgame **gameslist, struct spritesstruct *sprites, SDL_Renderer *renderer, SDL_Window *window, struct videosettings *settings, char *levcomment, int levelscount, int selection, int playedlevel, char **levelfile) {
   int i, winw, winh, maxallowedlevel;
   char levelnum[64];
   SDL_Event event;
-  /* reload all solutions for levels, in case they changed (for ex. because we just solved a level..) */
-  sok_loadsolutions(gameslist, levelscount);
+  /* reload the solution of the level that was just played, in case it changed (for ex. because we just solved it..) */
+  if ((playedlevel >= 0) && (playedlevel < levelscount)) sok_reloadsolution(gameslist[playedlevel]);
 
   /* if no current level is selected, then preselect the first unsolved level */
   if (selection < 0) {
@@ -1020,6 +1505,7 @@ static int selectlevel(struct sokgame **gameslist, struct spritesstruct *sprites
     SDL_GetWindowSize(window, &winw, &winh);
 
     /* draw the screen */
+    perf_zone_begin(PERF_DRAWSCREEN);
     SDL_RenderClear(renderer);
     /* draw the level before */
     if (selection > 0) blit_levelmap(gameslist[selection - 1], sprites, winw / 5, winh / 2, renderer, settings->tilesize / 4, 96, 0);
@@ -1032,17 +1518,29 @@ static int selectlevel(struct sokgame **gameslist, struct spritesstruct *sprites
     draw_string("(choose a level)", 100, 255, sprites, renderer, DRAWSTRING_CENTER, winh / 8 + 40, window, 1, 0);
     sprintf(levelnum, "Level %d of %d", selection + 1, levelscount);
     draw_string(levelnum, 100, 255, sprites, renderer, DRAWSTRING_CENTER, winh * 3 / 4, window, 1, 0);
-    SDL_RenderPresent(renderer);
+    perf_zone_end(PERF_DRAWSCREEN);
+    render_present(renderer, sprites, window, settings);
 
-    /* Wait for an event - but ignore 'KEYUP' and 'MOUSEMOTION' events, since they are worthless in this game */
-    for (;;) if ((SDL_WaitEvent(&event) != 0) && (event.type != SDL_KEYUP) && (event.type != SDL_MOUSEMOTION)) break;
+    /* Wait for an event - but ignore 'KEYUP' and 'MOUSEMOTION' events, since they are worthless in this game.
+     * While no event is pending, use the idle time to pre-render thumbnails of neighbouring levels. */
+    for (;;) {
+      if (SDL_PollEvent(&event) == 0) {
+        if (thumbcache_prefetch(renderer, sprites, gameslist, selection, maxallowedlevel, settings->tilesize) != 0) continue;
+        if (SDL_WaitEvent(&event) == 0) continue;
+      }
+      if ((event.type != SDL_KEYUP) && (event.type != SDL_MOUSEMOTION)) break;
+    }
 
     /* check what event we got */
     if (event.type == SDL_QUIT) {
       return(SELECTLEVEL_QUIT);
+    } else if ((event.type == SDL_RENDER_TARGETS_RESET) || (event.type == SDL_RENDER_DEVICE_RESET)) {
+      /* content of target textures is lost */
+      thumbcache_flush();
+      gra_flushcache(sprites);
     } else if (event.type == SDL_DROPFILE) {
       if (processDropFileEvent(&event, levelfile) != NULL) {
-        fade2texture(renderer, window, sprites->black);
+        fade2texture(renderer, window, sprites->black, settings);
         return(SELECTLEVEL_LOADFILE);
       }
     } else if (event.type == SDL_KEYDOWN) {
@@ -1084,8 +1582,11 @@ static int selectlevel(struct sokgame **gameslist, struct spritesstruct *sprites
         case KEY_FULLSCREEN:
           switchfullscreen(window);
           break;
+        case KEY_F12:
+          settings->perfoverlay ^= 1;
+          break;
         case KEY_ESCAPE:
-          fade2texture(renderer, window, sprites->black);
+          fade2texture(renderer, window, sprites->black, settings);
           return(SELECTLEVEL_BACK);
       }
     }
@@ -1163,81 +1664,335 @@ static void dumplevel2clipboard(struct sokgame *game, char *history) {
   free(txt);
 }
 
-/* reads a chunk of text from memory. returns the line in a chunk of memory that needs to be freed afterwards */
-static char *readmemline(char **memptrptr) {
-  unsigned long linelen;
-  char *res;
-  char *memptr;
-  memptr = *memptrptr;
-  if (*memptr == 0) return(NULL);
-  /* check how long the line is */
-  for (linelen = 0; ; linelen += 1) {
-    if (memptr[linelen] == 0) break;
-    if (memptr[linelen] == '\n') break;
-  }
-  /* allocate memory for the line, and copy its content */
-  res = malloc(linelen + 1);
-  memcpy(res, memptr, linelen);
-  /* move the original pointer forward */
-  *memptrptr += linelen;
-  if (**memptrptr == '\n') *memptrptr += 1;
-  /* trim out trailing \r, if any */
-  if ((linelen > 0) && (res[linelen - 1] == '\r')) linelen -= 1;
-  /* terminate the line with a null terminator */
-  res[linelen] = 0;
+/* one entry of the internet levels catalog. the catalog is a text file with
+ * one level set per line, made of tab-separated fields */
+#define CATALOG_FILE 0
+#define CATALOG_TITLE 1
+#define CATALOG_AUTHOR 2
+#define CATALOG_DESC 3
+#define CATALOG_FIELDS 4
+
+struct catalogentry {
+  char *field[CATALOG_FIELDS]; /* point into the catalog buffer itself */
+  unsigned short titlelen;
+};
+
+
+/* indexes a catalog in a single pass. the buffer is split in place (tabs and
+ * line endings become NUL terminators) so fields are used right where they
+ * are, nothing is copied. missing fields point to an empty string. returns
+ * the number of entries, with the index in *entries (to be freed), or -1 on
+ * allocation failure */
+static int catalog_index(char *buf, struct catalogentry **entries) {
+  static char empty[1] = "";
+  struct catalogentry *list = NULL, *newlist;
+  int count = 0, alloc = 0, f;
+
+  while (*buf != 0) {
+    if ((*buf == '\n') || (*buf == '\r')) { /* skip empty lines */
+      buf += 1;
+      continue;
+    }
+    if (count == alloc) {
+      alloc = (alloc == 0) ? 256 : alloc * 2;
+      newlist = realloc(list, sizeof(struct catalogentry) * alloc);
+      if (newlist == NULL) {
+        free(list);
+        return(-1);
+      }
+      list = newlist;
+    }
+    for (f = 0; f < CATALOG_FIELDS; f++) list[count].field[f] = empty;
+    for (f = 0;; buf++) {
+      if ((f < CATALOG_FIELDS) && (list[count].field[f] == empty)) list[count].field[f] = buf;
+      if ((*buf == 0) || (*buf == '\n')) break;
+      if (*buf == '\r') *buf = 0;
+      if (*buf == '\t') {
+        *buf = 0;
+        f += 1;
+      }
+    }
+    if (*buf == '\n') *(buf++) = 0;
+    list[count].titlelen = (unsigned short)strlen(list[count].field[CATALOG_TITLE]);
+    count += 1;
+  }
+  *entries = list;
+  return(count);
+}
+
+
+/* returns non-zero if title contains the (lowercase) needle, ignoring case */
+static int catalog_match(const char *title, unsigned short titlelen, const char *needle, int needlelen) {
+  int i, j;
+  for (i = 0; i + needlelen <= titlelen; i++) {
+    for (j = 0; j < needlelen; j++) {
+      if (tolower((unsigned char)title[i + j]) != needle[j]) break;
+    }
+    if (j == needlelen) return(1);
+  }
+  return(0);
+}
+
+
+/* computes the list of entries whose title contains query into view. if
+ * refine is set, query only got longer since view was computed, so only
+ * the entries already in view need to be looked at again. returns the new
+ * amount of entries in view */
+static int catalog_filter(const struct catalogentry *entries, int count, const char *query, int *view, int viewlen, int refine) {
+  char needle[64];
+  int i, len, res = 0;
+
+  for (len = 0; (query[len] != 0) && (len < (int)sizeof(needle)); len++) needle[len] = (char)tolower((unsigned char)query[len]);
+  if (refine == 0) {
+    viewlen = count;
+    for (i = 0; i < count; i++) view[i] = i;
+  }
+  if (len == 0) return(viewlen);
+  for (i = 0; i < viewlen; i++) {
+    if (catalog_match(entries[view[i]].field[CATALOG_TITLE], entries[view[i]].titlelen, needle, len)) view[res++] = view[i];
+  }
   return(res);
 }
 
-static void fetchtoken(char *res, char *buf, int pos) {
-  int tokpos = 0, x;
-  /* forward to the position where the token starts */
-  while (tokpos != pos) {
-    if (*buf == 0) {
-      break;
-    } else if (*buf == '\t') {
-      tokpos += 1;
+
+
+/* displays a progress bar until job is over, so the window stays responsive.
+ * returns 0 once the transfer is over (the result is then in *resptr and
+ * *reslen, *resptr being NULL on failure), SELECTLEVEL_BACK if the user
+ * cancelled with ESC, or SELECTLEVEL_QUIT. job is released in all cases */
+static int netjob_withprogress(SDL_Renderer *renderer, SDL_Window *window, struct spritesstruct *sprites, const struct videosettings *settings, const char *title, struct netjob *job, unsigned char **resptr, size_t *reslen) {
+  SDL_Event event;
+  char buff[64];
+  long received, total;
+  int winw, winh;
+  SDL_Rect bar;
+
+  *resptr = NULL;
+  *reslen = 0;
+  while (netjob_isdone(job) == 0) {
+    /* draw the progress screen */
+    get_drawarea(renderer, window, &winw, &winh);
+    netjob_progress(job, &received, &total);
+    SDL_RenderClear(renderer);
+    gra_renderbg(renderer, sprites, SPRITE_BG, settings->tilesize, winw, winh);
+    draw_string(title, 100, 255, sprites, renderer, DRAWSTRING_CENTER, winh / 2 - sprites->em * 3, window, 1, 0);
+    bar.w = winw * 2 / 3;
+    bar.h = sprites->em;
+    bar.x = (winw - bar.w) / 2;
+    bar.y = (winh - bar.h) / 2;
+    SDL_SetRenderDrawColor(renderer, 0x30, 0x30, 0x30, 255);
+    perf_drawcall(NULL);
+    SDL_RenderFillRect(renderer, &bar);
+    SDL_SetRenderDrawColor(renderer, 0xC0, 0xC0, 0xC0, 255);
+    perf_drawcall(NULL);
+    SDL_RenderDrawRect(renderer, &bar);
+    if ((total > 0) && (received <= total)) {
+      bar.w = (int)((double)bar.w * received / total);
+      perf_drawcall(NULL);
+      SDL_RenderFillRect(renderer, &bar);
+      sprintf(buff, "%ld / %ld KiB", received / 1024, total / 1024);
+    } else {
+      sprintf(buff, "%ld KiB", received / 1024);
+    }
+    SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
+    draw_string(buff, 65, 255, sprites, renderer, DRAWSTRING_CENTER, winh / 2 + sprites->em, window, 1, 0);
+    draw_string("press ESC to cancel", 65, 180, sprites, renderer, DRAWSTRING_CENTER, DRAWSTRING_BOTTOM, window, 1, 0);
+    render_present(renderer, sprites, window, settings);
+
+    /* wait for completion, a key, or the next progress refresh */
+    if (SDL_WaitEventTimeout(&event, 100) == 0) continue;
+    if (event.type == SDL_QUIT) {
+      netjob_cancel(job);
+      return(SELECTLEVEL_QUIT);
+    } else if ((event.type == SDL_KEYDOWN) && (normalizekeys(event.key.keysym.sym) == KEY_ESCAPE)) {
+      netjob_cancel(job);
+      return(SELECTLEVEL_BACK);
+    } else if ((event.type == SDL_RENDER_TARGETS_RESET) || (event.type == SDL_RENDER_DEVICE_RESET)) {
+      gra_flushcache(sprites);
+    }
+  }
+
+  *reslen = netjob_finish(job, resptr);
+  if (*resptr == NULL) *reslen = 0;
+  return(0);
+}
+
+
+/* fetches host/path on a background thread while displaying a progress bar,
+ * see netjob_withprogress() */
+static int http_get_withprogress(SDL_Renderer *renderer, SDL_Window *window, struct spritesstruct *sprites, const struct videosettings *settings, const char *title, const char *host, unsigned short port, const char *path, unsigned char **resptr, size_t *reslen) {
+  struct netjob *job;
+
+  job = netjob_start(host, port, path, 0);
+  if (job == NULL) { /* no thread? do it the old way then */
+    *reslen = httpcache_get(host, port, path, resptr, NULL);
+    if (*resptr == NULL) *reslen = 0;
+    return(0);
+  }
+  return(netjob_withprogress(renderer, window, sprites, settings, title, job, resptr, reslen));
+}
+
+
+/* level sets downloaded ahead of time, while the user browses the list of
+ * internet levels: the highlighted entry and its neighbours */
+#define PREFETCH_SLOTS 3
+#define PREFETCH_MAXMEM (8 * 1024 * 1024) /* max bytes of prefetched data kept in memory */
+
+struct prefetch {
+  int entry;             /* catalog entry, -1 if the slot is free */
+  struct netjob *job;    /* transfer in progress, if any */
+  unsigned char *res;    /* downloaded data (NULL if failed or over budget) */
+  size_t reslen;
+  size_t maxlen;         /* share of the memory budget the transfer may use */
+};
+
+
+static struct prefetch *prefetch_find(struct prefetch *slots, int entry) {
+  int i;
+  for (i = 0; i < PREFETCH_SLOTS; i++) {
+    if (slots[i].entry == entry) return(&(slots[i]));
+  }
+  return(NULL);
+}
+
+
+/* frees a slot, cancelling its transfer if still running */
+static void prefetch_drop(struct prefetch *slot) {
+  if (slot->job != NULL) netjob_cancel(slot->job);
+  free(slot->res);
+  memset(slot, 0, sizeof(*slot));
+  slot->entry = -1;
+}
+
+
+/* returns how much of the memory budget is taken: data already downloaded,
+ * plus the whole share reserved by each transfer still running */
+static size_t prefetch_used(const struct prefetch *slots) {
+  size_t used = 0;
+  int i;
+  for (i = 0; i < PREFETCH_SLOTS; i++) used += (slots[i].job != NULL) ? slots[i].maxlen : slots[i].reslen;
+  return(used);
+}
+
+
+/* collects finished transfers. transfers abort once they get larger than
+ * their share of the memory budget, and a cached copy that does not fit is
+ * dropped here: either way the slot stays taken, so the set is not
+ * downloaded again and again. it will be fetched the usual way if selected
+ * (most probably from the disk cache then) */
+static void prefetch_collect(struct prefetch *slots) {
+  int i;
+  for (i = 0; i < PREFETCH_SLOTS; i++) {
+    if ((slots[i].job == NULL) || (netjob_isdone(slots[i].job) == 0)) continue;
+    slots[i].reslen = netjob_finish(slots[i].job, &(slots[i].res));
+    slots[i].job = NULL;
+    if ((slots[i].res == NULL) || (slots[i].reslen > slots[i].maxlen)) {
+      free(slots[i].res);
+      slots[i].res = NULL;
+      slots[i].reslen = 0;
     }
-    buf += 1;
   }
-  /* copy the token to buf, until \t or \0 */
-  for (x = 0;; x++) {
-    if (buf[x] == '\0') break;
-    if (buf[x] == '\t') break;
-    res[x] = buf[x];
+}
+
+
+/* moves the prefetch window around the selected row of view: stale slots
+ * are dropped (cancelling their transfers) and missing neighbours start
+ * downloading, the selected entry first. each new transfer reserves an even
+ * share of what is left of the memory budget. if nothing is left, the
+ * neighbour waits for a later call, once other transfers are collected */
+static void prefetch_update(struct prefetch *slots, const char *host, unsigned short port, const char *path, const struct catalogentry *catalog, const int *view, int viewlen, int selection) {
+  static const int around[PREFETCH_SLOTS] = {0, 1, -1};
+  int wanted[PREFETCH_SLOTS];
+  char url[2048];
+  size_t share;
+  int i, j, missing = 0;
+
+  for (i = 0; i < PREFETCH_SLOTS; i++) {
+    wanted[i] = -1;
+    if ((selection + around[i] >= 0) && (selection + around[i] < viewlen)) wanted[i] = view[selection + around[i]];
+  }
+  for (i = 0; i < PREFETCH_SLOTS; i++) {
+    if (slots[i].entry < 0) continue;
+    for (j = 0; (j < PREFETCH_SLOTS) && (wanted[j] != slots[i].entry); j++);
+    if (j == PREFETCH_SLOTS) prefetch_drop(&(slots[i]));
+  }
+  for (i = 0; i < PREFETCH_SLOTS; i++) {
+    if ((wanted[i] >= 0) && (prefetch_find(slots, wanted[i]) == NULL)) missing++;
+  }
+  for (i = 0; i < PREFETCH_SLOTS; i++) {
+    if ((wanted[i] < 0) || (prefetch_find(slots, wanted[i]) != NULL)) continue;
+    share = (PREFETCH_MAXMEM - prefetch_used(slots)) / missing--;
+    if (share < 1024) continue; /* not worth it */
+    for (j = 0; slots[j].entry >= 0; j++); /* a free slot always exists here */
+    sprintf(url, "%s%.1000s", path, catalog[wanted[i]].field[CATALOG_FILE]);
+    slots[j].job = netjob_start(host, port, url, share);
+    slots[j].maxlen = share;
+    if (slots[j].job != NULL) slots[j].entry = wanted[i];
   }
-  res[x] = 0;
 }
 
 
-static int selectinternetlevel(SDL_Renderer *renderer, SDL_Window *window, struct spritesstruct *sprites, char *host, unsigned short port, char *path, char *levelslist, unsigned char **xsbptr, size_t *reslen) {
+/* returns the (allocated) name of the file where a level set is downloaded
+ * when it is not kept in memory, or NULL if there is no pref directory */
+static char *netlevel_filename(void) {
+  char *prefpath, *res;
+  prefpath = SDL_GetPrefPath("", "simplesok");
+  if (prefpath == NULL) return(NULL);
+  res = malloc(strlen(prefpath) + 16);
+  if (res != NULL) sprintf(res, "%snetlevel.xsb", prefpath);
+  SDL_free(prefpath);
+  return(res);
+}
+
+
+/* lets the user pick a level set from the internet catalog (levelslist,
+ * which gets split in place). typing filters the list by title. the set is
+ * returned in memory (*xsbptr) if it was prefetched or is in the disk cache,
+ * otherwise it is streamed to disk and the name of the file is returned in
+ * *xsbfile */
+static int selectinternetlevel(SDL_Renderer *renderer, SDL_Window *window, struct spritesstruct *sprites, const struct videosettings *settings, char *host, unsigned short port, char *path, char *levelslist, unsigned char **xsbptr, size_t *reslen, char **xsbfile) {
   unsigned char *res = NULL;
-  char url[2048], buff[1200], buff2[1024];
-  char *inetlist[1024];
-  int inetlistlen = 0, i, selected = 0, windowrows, fontheight = 24, winw, winh;
+  char url[2048], buff[1200], query[64];
+  struct catalogentry *catalog = NULL, *entry;
+  int *view;
+  int catalogsize, viewlen, querylen = 0, i, selected = 0, windowrows, fontheight = 24, winw, winh;
   static int selection = 0, seloffset = 0;
+  struct prefetch prefetch[PREFETCH_SLOTS], *slot;
   SDL_Event event;
   *xsbptr = NULL;
   *reslen = 0;
-  /* load levelslist into an array */
-  for (;;) {
-    inetlist[inetlistlen] = readmemline(&levelslist);
-    if (inetlist[inetlistlen] == NULL) break;
-    inetlistlen += 1;
-    if (inetlistlen >= 1024) break;
+  *xsbfile = NULL;
+  memset(prefetch, 0, sizeof(prefetch));
+  for (i = 0; i < PREFETCH_SLOTS; i++) prefetch[i].entry = -1;
+  query[0] = 0;
+  /* index the catalog, view holds the entries matching the query */
+  catalogsize = catalog_index(levelslist, &catalog);
+  if (catalogsize < 1) { /* if failed to load any level, quit here */
+    free(catalog);
+    return(SELECTLEVEL_BACK);
+  }
+  view = malloc(sizeof(int) * catalogsize);
+  if (view == NULL) {
+    free(catalog);
+    return(SELECTLEVEL_BACK);
+  }
+  viewlen = catalog_filter(catalog, catalogsize, query, view, 0, 0);
+  if (selection >= viewlen) { /* the list might have shrunk since last time */
+    selection = 0;
+    seloffset = 0;
   }
-  if (inetlistlen < 1) return(SELECTLEVEL_BACK); /* if failed to load any level, quit here */
   /* selection loop */
   for (;;) {
     SDL_Rect rect;
+    prefetch_update(prefetch, host, port, path, catalog, view, viewlen, selection);
     /* compute the amount of rows we can fit onscreen */
     SDL_GetWindowSize(window, &winw, &winh);
     windowrows = (winh / fontheight) - 7;
     /* display the list of levels */
     SDL_RenderClear(renderer);
     for (i = 0; i < windowrows; i++) {
-      if (i + seloffset >= inetlistlen) break;
-      fetchtoken(buff, inetlist[i + seloffset], 1);
-      draw_string(buff, 100, 255, sprites, renderer, 30, i * fontheight, window, 1, 0);
+      if (i + seloffset >= viewlen) break;
+      draw_string(catalog[view[i + seloffset]].field[CATALOG_TITLE], 100, 255, sprites, renderer, 30, i * fontheight, window, 1, 0);
       if (i + seloffset == selection) {
         gra_rendertile(renderer, sprites, sprites->playerid, 0, i * fontheight, 30, 90);
       }
@@ -1254,13 +2009,20 @@ static int selectinternetlevel(SDL_Renderer *renderer, SDL_Window *window, struc
     SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
     /* draw level description */
     rect.y += fontheight / 2;
-    fetchtoken(buff2, inetlist[selection], 1);
-    draw_string(buff2, 100, 250, sprites, renderer, DRAWSTRING_CENTER, rect.y, window, 1, 0);
-    fetchtoken(buff2, inetlist[selection], 2);
-    sprintf(buff, "Copyright (C) %s", buff2);
-    draw_string(buff, 65, 200, sprites, renderer, DRAWSTRING_CENTER, rect.y + (fontheight * 12 / 10), window, 1, 0);
-    fetchtoken(buff, inetlist[selection], 3);
-    draw_string(buff, 100, 210, sprites, renderer, 0, rect.y + (fontheight * 26 / 10), window, 3, fontheight);
+    if (selection < viewlen) {
+      entry = &(catalog[view[selection]]);
+      draw_string(entry->field[CATALOG_TITLE], 100, 250, sprites, renderer, DRAWSTRING_CENTER, rect.y, window, 1, 0);
+      sprintf(buff, "Copyright (C) %.1000s", entry->field[CATALOG_AUTHOR]);
+      draw_string(buff, 65, 200, sprites, renderer, DRAWSTRING_CENTER, rect.y + (fontheight * 12 / 10), window, 1, 0);
+      draw_string(entry->field[CATALOG_DESC], 100, 210, sprites, renderer, 0, rect.y + (fontheight * 26 / 10), window, 3, fontheight);
+    } else {
+      draw_string("no matching level set", 100, 250, sprites, renderer, DRAWSTRING_CENTER, rect.y, window, 1, 0);
+    }
+    /* draw the search query, if any */
+    if (querylen > 0) {
+      sprintf(buff, "search: %s (%d/%d)", query, viewlen, catalogsize);
+      draw_string(buff, 65, 200, sprites, renderer, DRAWSTRING_RIGHT, DRAWSTRING_BOTTOM, window, 1, 0);
+    }
     /* refresh screen */
     SDL_RenderPresent(renderer);
     /* Wait for an event - but ignore 'KEYUP' and 'MOUSEMOTION' events, since they are worthless in this game */
@@ -1269,59 +2031,123 @@ static int selectinternetlevel(SDL_Renderer *renderer, SDL_Window *window, struc
       if ((event.type != SDL_KEYUP) && (event.type != SDL_MOUSEMOTION)) break;
     }
     /* check what event we got */
-    if (event.type == SDL_QUIT) {
-        selected = SELECTLEVEL_QUIT;
-      /* } else if (event.type == SDL_DROPFILE) {
-        if (processDropFileEvent(&event, &levelfile) != NULL) {
-          fade2texture(renderer, window, sprites->black);
-          goto GametypeSelectMenu;
-        } */
-      } else if (event.type == SDL_KEYDOWN) {
-        switch (normalizekeys(event.key.keysym.sym)) {
-          case KEY_UP:
-            if (selection > 0) selection -= 1;
-            if ((seloffset > 0) && (selection < seloffset + 2)) seloffset -= 1;
-            break;
-          case KEY_DOWN:
-            if (selection + 1 < inetlistlen) selection += 1;
-            if ((seloffset < inetlistlen - windowrows) && (selection >= seloffset + windowrows - 2)) seloffset += 1;
-            break;
-          case KEY_ENTER:
-            selected = SELECTLEVEL_OK;
-            break;
-          case KEY_ESCAPE:
+    if (event.type == netjob_eventtype()) {
+      prefetch_collect(prefetch);
+    } else if (event.type == SDL_QUIT) {
+      selected = SELECTLEVEL_QUIT;
+    /* } else if (event.type == SDL_DROPFILE) {
+      if (processDropFileEvent(&event, &levelfile) != NULL) {
+        fade2texture(renderer, window, sprites->black, settings);
+        goto GametypeSelectMenu;
+      } */
+    } else if (event.type == SDL_TEXTINPUT) {
+      /* typed text narrows the list down */
+      for (i = 0; (event.text.text[i] != 0) && (querylen + 1 < (int)sizeof(query)); i++) {
+        if ((unsigned char)event.text.text[i] < 32) continue;
+        query[querylen++] = event.text.text[i];
+      }
+      query[querylen] = 0;
+      viewlen = catalog_filter(catalog, catalogsize, query, view, viewlen, 1);
+      selection = 0;
+      seloffset = 0;
+    } else if ((event.type == SDL_KEYDOWN) && (keytypestext(&(event.key.keysym)) == 0)) { /* typing goes to the search query */
+      switch (normalizekeys(event.key.keysym.sym)) {
+        case KEY_UP:
+          if (selection > 0) selection -= 1;
+          if ((seloffset > 0) && (selection < seloffset + 2)) seloffset -= 1;
+          break;
+        case KEY_DOWN:
+          if (selection + 1 < viewlen) selection += 1;
+          if ((seloffset < viewlen - windowrows) && (selection >= seloffset + windowrows - 2)) seloffset += 1;
+          break;
+        case KEY_ENTER:
+          if (selection < viewlen) selected = SELECTLEVEL_OK;
+          break;
+        case KEY_BACKSPACE:
+          if (querylen == 0) break;
+          /* UTF-8 continuation bytes go along with their lead byte */
+          do {
+            querylen -= 1;
+          } while ((querylen > 0) && ((query[querylen] & 0xC0) == 0x80));
+          query[querylen] = 0;
+          viewlen = catalog_filter(catalog, catalogsize, query, view, viewlen, 0);
+          selection = 0;
+          seloffset = 0;
+          break;
+        case KEY_ESCAPE:
+          if (querylen == 0) {
             selected = SELECTLEVEL_BACK;
             break;
-          case KEY_FULLSCREEN:
-            switchfullscreen(window);
-            break;
-          case KEY_HOME:
-            selection = 0;
-            seloffset = 0;
-            break;
-          case KEY_END:
-            selection = inetlistlen - 1;
-            seloffset = inetlistlen - windowrows;
-            break;
+          }
+          /* ESC clears the search first */
+          querylen = 0;
+          query[0] = 0;
+          viewlen = catalog_filter(catalog, catalogsize, query, view, viewlen, 0);
+          selection = 0;
+          seloffset = 0;
+          break;
+        case KEY_FULLSCREEN:
+          switchfullscreen(window);
+          break;
+        case KEY_HOME:
+          selection = 0;
+          seloffset = 0;
+          break;
+        case KEY_END:
+          selection = viewlen - 1;
+          seloffset = viewlen - windowrows;
+          if (selection < 0) selection = 0;
+          if (seloffset < 0) seloffset = 0;
+          break;
+      }
+    }
+    /* fetch the selected level, cancelling the download gets back to the list */
+    if (selected == SELECTLEVEL_OK) {
+      int fetchres;
+      entry = &(catalog[view[selection]]);
+      sprintf(url, "%s%.1000s", path, entry->field[CATALOG_FILE]);
+      prefetch_collect(prefetch);
+      slot = prefetch_find(prefetch, view[selection]);
+      if ((slot != NULL) && (slot->res != NULL)) { /* already there */
+        res = slot->res;
+        *reslen = slot->reslen;
+        slot->res = NULL;
+        prefetch_drop(slot);
+        fetchres = 0;
+      } else if ((slot != NULL) && (slot->job != NULL)) { /* on its way */
+        struct netjob *job = slot->job;
+        slot->job = NULL;
+        prefetch_drop(slot);
+        fetchres = netjob_withprogress(renderer, window, sprites, settings, entry->field[CATALOG_TITLE], job, &res, reslen);
+      } else {
+        /* not prefetched, so possibly too large to be held in memory: take
+         * it from the disk cache if it is there, stream it to disk otherwise,
+         * with constant memory use whatever its size */
+        struct netjob *job = NULL;
+        *xsbfile = netlevel_filename();
+        if (*xsbfile != NULL) job = netjob_start_tofile(host, port, url, *xsbfile);
+        if (job != NULL) {
+          fetchres = netjob_withprogress(renderer, window, sprites, settings, entry->field[CATALOG_TITLE], job, &res, reslen);
+          if ((fetchres != 0) || (*reslen == 0) || (res != NULL)) { /* nothing usable, or got it in memory */
+            free(*xsbfile);
+            *xsbfile = NULL;
+          }
+        } else {
+          free(*xsbfile);
+          *xsbfile = NULL;
+          fetchres = http_get_withprogress(renderer, window, sprites, settings, entry->field[CATALOG_TITLE], host, port, url, &res, reslen);
         }
+      }
+      if (fetchres == SELECTLEVEL_BACK) selected = 0;
+      if (fetchres == SELECTLEVEL_QUIT) selected = SELECTLEVEL_QUIT;
     }
     if (selected != 0) break;
   }
-  /* fetch the selected level */
-  if (selected == SELECTLEVEL_OK) {
-    fetchtoken(buff, inetlist[selection], 0);
-    sprintf(url, "%s%s", path, buff);
-    *reslen = http_get(host, port, url, &res);
-    *xsbptr = res;
-  } else {
-    *xsbptr = NULL;
-  }
-  /* free the list */
-  while (inetlistlen > 0) {
-    inetlistlen -= 1;
-    free(inetlist[inetlistlen]);
-  }
-  fade2texture(renderer, window, sprites->black);
+  *xsbptr = res;
+  for (i = 0; i < PREFETCH_SLOTS; i++) prefetch_drop(&(prefetch[i]));
+  free(view);
+  free(catalog);
+  fade2texture(renderer, window, sprites->black, settings);
   return(selected);
 }
 
@@ -1356,11 +2182,390 @@ static void list_installed_skins(void) {
 }
 
 
-static int parse_cmdline(struct videosettings *settings, int argc, char **argv, char **levelfile) {
+/* context of mirror_netlevels() transfers */
+struct mirrorctx {
+  const char *dir;
+  char **names;     /* local file name of every transfer */
+  int done, total, failed;
+};
+
+
+/* stores a completed mirror transfer, once it has been checked to hold
+ * loadable levels. files are written under a temporary name and renamed,
+ * so an interrupted mirror never leaves a truncated level file behind */
+static void mirror_store(void *ctx, int idx, unsigned char *data, size_t len) {
+  struct mirrorctx *mirror = ctx;
+  struct sokgame **gameslist;
+  char fname[1024], tmpname[1024];
+  int levelscount = -1;
+  FILE *fd;
+
+  mirror->done += 1;
+  sprintf(fname, "%.900s/%s", mirror->dir, mirror->names[idx]);
+  sprintf(tmpname, "%s.part", fname);
+  gameslist = malloc(sizeof(struct sokgame *) * MAXLEVELS);
+  /* sok_loadfile() might inflate gzipped data, but never alters it */
+  if ((data != NULL) && (gameslist != NULL)) levelscount = sok_loadfile(gameslist, MAXLEVELS, NULL, data, len, NULL, 0);
+  if (levelscount > 0) sok_freefile(gameslist, levelscount);
+  free(gameslist);
+  if (levelscount <= 0) {
+    printf("[%d/%d] %s: FAILED (%s)\n", mirror->done, mirror->total, mirror->names[idx], (data == NULL) ? "download error" : "no valid level");
+    mirror->failed += 1;
+    free(data);
+    return;
+  }
+  fd = fopen(tmpname, "wb");
+  if (fd != NULL) {
+    if ((fwrite(data, 1, len, fd) != len) | (fclose(fd) != 0)) {
+      remove(tmpname);
+      fd = NULL;
+    } else {
+      remove(fname); /* rename() does not replace files on all systems */
+      if (rename(tmpname, fname) != 0) {
+        remove(tmpname);
+        fd = NULL;
+      }
+    }
+  }
+  if (fd == NULL) {
+    printf("[%d/%d] %s: FAILED (unable to write %s)\n", mirror->done, mirror->total, mirror->names[idx], fname);
+    mirror->failed += 1;
+  } else {
+    printf("[%d/%d] %s: %d levels, %lu bytes\n", mirror->done, mirror->total, mirror->names[idx], levelscount, (unsigned long)len);
+  }
+  free(data);
+}
+
+
+/* downloads every level file of the internet catalog into dir, several at
+ * a time. files already present in dir (and loadable) are skipped, so an
+ * interrupted mirror can be resumed by simply running it again. returns 0
+ * on success, non-zero if anything could not be mirrored */
+static int mirror_netlevels(const char *dir) {
+  struct mirrorctx mirror;
+  struct sokgame **gameslist;
+  struct catalogentry *catalog = NULL;
+  char **paths = NULL, **names = NULL;
+  char *levelslist = NULL, *name;
+  char fname[1024];
+  int catalogsize = -1, listlen = 0, count = 0, skipped = 0, i;
+
+  gameslist = malloc(sizeof(struct sokgame *) * MAXLEVELS);
+  if ((gameslist != NULL) && (http_get(INET_HOST, INET_PORT, INET_PATH, (unsigned char **) &levelslist) != 0) && (levelslist != NULL)) {
+    catalogsize = catalog_index(levelslist, &catalog);
+  }
+  if (catalogsize > 0) names = malloc(sizeof(char *) * catalogsize);
+  if (names == NULL) {
+    printf("failed to fetch the list of internet levels from %s\n", INET_HOST);
+    free(catalog);
+    free(gameslist);
+    free(levelslist);
+    return(1);
+  }
+
+  /* build the list of files to fetch, skipping those already mirrored */
+  for (i = 0; i < catalogsize; i++) {
+    int levelscount;
+    name = catalog[i].field[CATALOG_FILE];
+    /* never let the catalog point outside of dir */
+    if ((name[0] == 0) || (name[0] == '.') || (strlen(name) > 100) || (strchr(name, '/') != NULL) || (strchr(name, '\\') != NULL)) continue;
+    listlen += 1;
+    sprintf(fname, "%.900s/%s", dir, name);
+    levelscount = sok_loadfile(gameslist, MAXLEVELS, fname, NULL, 0, NULL, 0);
+    if (levelscount > 0) {
+      sok_freefile(gameslist, levelscount);
+      skipped += 1;
+      continue;
+    }
+    names[count++] = name;
+  }
+  free(catalog);
+  free(gameslist);
+
+  /* paths are all relative to the catalog location */
+  if (count > 0) paths = malloc(sizeof(char *) * count);
+  for (i = 0; (paths != NULL) && (i < count); i++) {
+    paths[i] = malloc(strlen(INET_PATH) + strlen(names[i]) + 1);
+    if (paths[i] == NULL) break;
+    sprintf(paths[i], "%s%s", INET_PATH, names[i]);
+  }
+  count = (paths != NULL) ? i : 0; /* whatever could not be allocated is not fetched */
+
+  printf("%d level files in catalog, %d already mirrored, %d to fetch\n", listlen, skipped, count);
+  mirror.dir = dir;
+  mirror.names = names;
+  mirror.done = 0;
+  mirror.total = count;
+  mirror.failed = listlen - skipped - count;
+  if ((count > 0) && (http_get_multi(INET_HOST, INET_PORT, (const char **) paths, count, MIRROR_MAXCONN, mirror_store, &mirror) != 0)) {
+    mirror.failed += count - mirror.done;
+  }
+
+  for (i = 0; (paths != NULL) && (i < count); i++) free(paths[i]);
+  free(paths);
+  free(names);
+  free(levelslist);
+  if (mirror.failed != 0) printf("%d level files could not be mirrored\n", mirror.failed);
+  return(mirror.failed != 0);
+}
+
+
+/* one transfer timed by bench_net(), run on its own thread so the caller
+ * can watch for the first byte of the body */
+struct benchfetch {
+  const char *host;
+  unsigned short port;
+  const char *path;
+  struct netprogress progress;
+  unsigned char *res;
+  size_t reslen;
+  SDL_atomic_t done;
+};
+
+
+static int bench_fetchthread(void *arg) {
+  struct benchfetch *fetch = arg;
+  fetch->reslen = http_request(fetch->host, fetch->port, fetch->path, &(fetch->res), &(fetch->progress), NULL);
+  SDL_AtomicSet(&(fetch->done), 1);
+  return(0);
+}
+
+
+/* counts completed transfers of http_get_multi() for bench_net() */
+static void bench_multidone(void *ctx, int idx, unsigned char *data, size_t len) {
+  (void)idx;
+  (void)len;
+  if (data != NULL) *(int *)ctx += 1;
+  free(data);
+}
+
+
+/* benchmarks the internet levels data path against server ("host[:port]",
+ * typically the httpd test tool): catalog requests per second, then for
+ * every level set of the catalog its time to first byte, download time and
+ * parsing time, and finally parallel requests per second. results are
+ * written as JSON to stdout. the response cache is bypassed so every
+ * request goes to the server. */
+static int bench_net(const char *server) {
+  #define NETBENCH_REPEAT 8
+  struct sokgame **gameslist;
+  struct catalogentry *catalog = NULL;
+  struct benchfetch fetch;
+  SDL_Thread *thread;
+  char host[256], path[2048];
+  char *levelslist = NULL, **paths;
+  unsigned short port = 80;
+  unsigned long ttfbsum = 0, totalsum = 0;
+  Uint64 t0, t1, ttfb, download;
+  int catalogsize = -1, i, levelscount, failed = 0, multiok = 0;
+
+  snprintf(host, sizeof(host), "%s", server);
+  if (strchr(host, ':') != NULL) {
+    port = (unsigned short)atoi(strchr(host, ':') + 1);
+    *strchr(host, ':') = 0;
+  }
+  gameslist = malloc(sizeof(struct sokgame *) * MAXLEVELS);
+  if (gameslist == NULL) return(1);
+
+  /* back-to-back catalog requests, connections are reused when possible */
+  printf("{\n  \"server\": \"%s:%u\",\n", host, port);
+  t0 = perf_gettimeus();
+  for (i = 0; i < NETBENCH_REPEAT; i++) {
+    free(levelslist);
+    levelslist = NULL;
+    if (http_request(host, port, INET_PATH, (unsigned char **) &levelslist, NULL, NULL) == 0) break;
+  }
+  t1 = perf_gettimeus();
+  if (levelslist != NULL) catalogsize = catalog_index(levelslist, &catalog);
+  if (catalogsize < 1) {
+    printf("  \"error\": \"failed to fetch the catalog\"\n}\n");
+    free(levelslist);
+    free(gameslist);
+    return(1);
+  }
+  printf("  \"catalog_entries\": %d,\n  \"catalog_rps\": %.1f,\n  \"sets\": [\n", catalogsize, NETBENCH_REPEAT * 1000000.0 / (double)(t1 - t0 + 1));
+
+  /* every level set, one after the other, as selectinternetlevel() would */
+  for (i = 0; i < catalogsize; i++) {
+    memset(&fetch, 0, sizeof(fetch));
+    sprintf(path, "%s%.1000s", INET_PATH, catalog[i].field[CATALOG_FILE]);
+    fetch.host = host;
+    fetch.port = port;
+    fetch.path = path;
+    t0 = perf_gettimeus();
+    thread = SDL_CreateThread(bench_fetchthread, "bench_net", &fetch);
+    if (thread == NULL) {
+      bench_fetchthread(&fetch);
+    } else {
+      while ((SDL_AtomicGet(&(fetch.progress.received)) == 0) && (SDL_AtomicGet(&(fetch.done)) == 0)); /* spin, for precision */
+    }
+    ttfb = perf_gettimeus() - t0;
+    if (thread != NULL) SDL_WaitThread(thread, NULL);
+    download = perf_gettimeus() - t0;
+    levelscount = -1;
+    if (fetch.res != NULL) levelscount = sok_loadfile(gameslist, MAXLEVELS, NULL, fetch.res, fetch.reslen, NULL, 0);
+    t1 = perf_gettimeus();
+    if (levelscount > 0) {
+      sok_freefile(gameslist, levelscount);
+      ttfbsum += (unsigned long)ttfb;
+      totalsum += (unsigned long)(t1 - t0);
+    } else {
+      failed += 1;
+    }
+    free(fetch.res);
+    printf("%s    {\"file\": \"%s\", \"bytes\": %lu, \"levels\": %d, \"ttfb_us\": %lu, \"download_us\": %lu, \"parse_us\": %lu, \"total_us\": %lu}", (i == 0) ? "" : ",\n", catalog[i].field[CATALOG_FILE], (unsigned long)fetch.reslen, levelscount, (unsigned long)ttfb, (unsigned long)download, (unsigned long)(t1 - t0 - download), (unsigned long)(t1 - t0));
+  }
+  printf("\n  ],\n");
+
+  /* the same sets again, several at a time like mirror_netlevels() */
+  paths = malloc(sizeof(char *) * catalogsize);
+  for (i = 0; (paths != NULL) && (i < catalogsize); i++) paths[i] = NULL;
+  for (i = 0; (paths != NULL) && (i < catalogsize); i++) {
+    paths[i] = malloc(strlen(INET_PATH) + strlen(catalog[i].field[CATALOG_FILE]) + 1);
+    if (paths[i] == NULL) break;
+    sprintf(paths[i], "%s%s", INET_PATH, catalog[i].field[CATALOG_FILE]);
+  }
+  if ((paths != NULL) && (i == catalogsize)) {
+    t0 = perf_gettimeus();
+    http_get_multi(host, port, (const char **) paths, catalogsize, MIRROR_MAXCONN, bench_multidone, &multiok);
+    t1 = perf_gettimeus();
+    printf("  \"parallel_connections\": %d,\n  \"parallel_ok\": %d,\n  \"parallel_rps\": %.1f,\n", MIRROR_MAXCONN, multiok, catalogsize * 1000000.0 / (double)(t1 - t0 + 1));
+  }
+  for (i = 0; (paths != NULL) && (i < catalogsize); i++) free(paths[i]);
+  free(paths);
+
+  printf("  \"failed\": %d,\n", failed);
+  printf("  \"avg_ttfb_us\": %lu,\n", (failed < catalogsize) ? ttfbsum / (unsigned long)(catalogsize - failed) : 0);
+  printf("  \"avg_total_us\": %lu\n}\n", (failed < catalogsize) ? totalsum / (unsigned long)(catalogsize - failed) : 0);
+  free(catalog);
+  free(levelslist);
+  free(gameslist);
+  return(failed != 0);
+}
+
+
+/* renders every level of a collection offscreen, at several tile sizes and
+ * animation offsets, and writes per-frame timings and draw call counts as
+ * JSON to outfile ("-" is stdout). if goldendir is set, every rendered frame
+ * is also saved there as a BMP file so outputs can be compared between runs.
+ * this needs no display at all, so it can run on headless CI machines. */
+static int bench_render(struct videosettings *settings, char *levelfile, const char *outfile, const char *goldendir) {
+  #define BENCH_REPEAT 8
+  static const unsigned short tilesizes[] = {16, 32, 48, 64, 0};
+  static const char *variants[] = {"static", "move", "scroll", NULL};
+  struct sokgame **gameslist, game;
+  struct sokgamestates *states;
+  struct spritesstruct *sprites;
+  SDL_Surface *surface;
+  SDL_Renderer *renderer;
+  FILE *fd;
+  char levcomment[32];
+  char fname[1024];
+  int levelscount, level, t, v, i, firstrecord = 1;
+  unsigned long framescount = 0;
+  Uint64 benchstart;
+
+  if (SDL_Init(0) != 0) {
+    fprintf(stderr, "SDL_Init() failed: %s\n", SDL_GetError());
+    return(1);
+  }
+  surface = SDL_CreateRGBSurfaceWithFormat(0, SCREEN_DEFAULT_WIDTH, SCREEN_DEFAULT_HEIGHT, 32, SDL_PIXELFORMAT_ARGB8888);
+  if (surface == NULL) {
+    fprintf(stderr, "Offscreen surface could not be created! SDL_Error: %s\n", SDL_GetError());
+    return(1);
+  }
+  renderer = SDL_CreateSoftwareRenderer(surface);
+  if (renderer == NULL) {
+    fprintf(stderr, "Software renderer could not be created! SDL_Error: %s\n", SDL_GetError());
+    SDL_FreeSurface(surface);
+    return(1);
+  }
+  sprites = skin_load(settings->customskinfile, renderer);
+  if (sprites == NULL) return(1);
+
+  gameslist = malloc(sizeof(struct sokgame *) * MAXLEVELS);
+  states = sok_newstates();
+  if ((gameslist == NULL) || (states == NULL)) {
+    fputs("Memory allocation failed!\n", stderr);
+    return(1);
+  }
+  if (levelfile != NULL) {
+    levelscount = sok_loadfile(gameslist, MAXLEVELS, levelfile, NULL, 0, levcomment, sizeof(levcomment));
+  } else {
+    levelscount = sok_loadfile(gameslist, MAXLEVELS, NULL, assets_levels_microban_xsb_gz, assets_levels_microban_xsb_gz_len, levcomment, sizeof(levcomment));
+  }
+  if (levelscount < 1) {
+    fprintf(stderr, "Failed to load the level file [%d]: %s\n", levelscount, sok_strerr(levelscount));
+    return(1);
+  }
+
+  if (strcmp(outfile, "-") == 0) {
+    fd = stdout;
+  } else {
+    fd = fopen(outfile, "wb");
+    if (fd == NULL) {
+      fprintf(stderr, "Failed to open '%s' for writing\n", outfile);
+      return(1);
+    }
+  }
+
+  fprintf(fd, "{\n  \"width\": %d,\n  \"height\": %d,\n  \"repeat\": %d,\n  \"frames\": [\n", SCREEN_DEFAULT_WIDTH, SCREEN_DEFAULT_HEIGHT, BENCH_REPEAT);
+  benchstart = perf_gettimeus();
+  for (level = 0; level < levelscount; level++) {
+    for (t = 0; tilesizes[t] != 0; t++) {
+      settings->tilesize = tilesizes[t];
+      gra_prescale(renderer, sprites, settings->tilesize);
+      for (v = 0; variants[v] != NULL; v++) {
+        int offset = 0, scrolling = 0;
+        Uint64 mintime = 0, totaltime = 0;
+        unsigned long drawcalls = 0, texbinds = 0;
+        /* "move" shifts the player and its neighbour by half a tile, "scroll"
+         * does the same while the whole playfield scrolls */
+        if (v > 0) offset = tilesizes[t] / 2;
+        if (v == 2) scrolling = tilesizes[t];
+        loadlevel(&game, gameslist[level], states);
+        for (i = 0; i < BENCH_REPEAT; i++) {
+          const struct perfframe *frame;
+          draw_screen(&game, states, sprites, renderer, NULL, settings, offset, 0, scrolling, 0, levcomment);
+          perf_endframe();
+          frame = perf_lastframe();
+          if ((i == 0) || (frame->zonetime[PERF_DRAWSCREEN] < mintime)) mintime = frame->zonetime[PERF_DRAWSCREEN];
+          totaltime += frame->zonetime[PERF_DRAWSCREEN];
+          drawcalls = frame->drawcalls;
+          texbinds = frame->texbinds;
+        }
+        framescount += BENCH_REPEAT;
+        if (goldendir != NULL) {
+          SDL_RenderPresent(renderer);
+          sprintf(fname, "%.900s/level%04d_%02u_%s.bmp", goldendir, level + 1, tilesizes[t], variants[v]);
+          if (SDL_SaveBMP(surface, fname) != 0) fprintf(stderr, "Failed to save golden frame '%s': %s\n", fname, SDL_GetError());
+        }
+        fprintf(fd, "%s    {\"level\": %d, \"tilesize\": %u, \"variant\": \"%s\", \"min_us\": %lu, \"avg_us\": %lu, \"drawcalls\": %lu, \"texbinds\": %lu}", (firstrecord != 0) ? "" : ",\n", level + 1, tilesizes[t], variants[v], (unsigned long)mintime, (unsigned long)(totaltime / BENCH_REPEAT), drawcalls, texbinds);
+        firstrecord = 0;
+      }
+    }
+  }
+  fprintf(fd, "\n  ],\n  \"levels\": %d,\n  \"total_frames\": %lu,\n  \"total_us\": %lu\n}\n", levelscount, framescount, (unsigned long)(perf_gettimeus() - benchstart));
+  if (fd != stdout) fclose(fd);
+
+  /* clean up */
+  sok_freestates(states);
+  sok_freefile(gameslist, levelscount);
+  free(gameslist);
+  skin_free(sprites);
+  SDL_DestroyRenderer(renderer);
+  SDL_FreeSurface(surface);
+  SDL_Quit();
+  return(0);
+}
+
+
+static int parse_cmdline(struct videosettings *settings, int argc, char **argv, char **levelfile, char **benchfile, char **goldendir, char **mirrordir, char **benchserver) {
   /* pre-set a few default settings */
   memset(settings, 0, sizeof(*settings));
   settings->framedelay = -1;
   settings->framefreq = -1;
+  settings->playspeed = 1;
   settings->customskinfile = DEFAULT_SKIN;
 
   /* parse the commandline */
@@ -1373,6 +2578,16 @@ static int parse_cmdline(struct videosettings *settings, int argc, char **argv,
         settings->framefreq = atoi(argv[i] + strlen("--framefreq="));
       } else if (strstr(argv[i], "--skin=") == argv[i]) {
         settings->customskinfile = argv[i] + strlen("--skin=");
+      } else if (strcmp(argv[i], "--bench-render") == 0) {
+        *benchfile = "-";
+      } else if (strstr(argv[i], "--bench-render=") == argv[i]) {
+        *benchfile = argv[i] + strlen("--bench-render=");
+      } else if (strstr(argv[i], "--bench-golden=") == argv[i]) {
+        *goldendir = argv[i] + strlen("--bench-golden=");
+      } else if (strstr(argv[i], "--mirror-netlevels=") == argv[i]) {
+        *mirrordir = argv[i] + strlen("--mirror-netlevels=");
+      } else if (strstr(argv[i], "--bench-net=") == argv[i]) {
+        *benchserver = argv[i] + strlen("--bench-net=");
       } else if (strcmp(argv[i], "--skinlist") == 0) {
         list_installed_skins();
         return(1);
@@ -1389,6 +2604,12 @@ static int parse_cmdline(struct videosettings *settings, int argc, char **argv,
         puts("  --framefreq=t       (microseconds)");
         puts("  --skin=name         skin name to be used (default: antique3)");
         puts("  --skinlist          display the list of installed skins");
+        puts("  --bench-render[=f]  benchmark offscreen rendering of all levels, write JSON");
+        puts("                      results to file f (default: stdout) and quit");
+        puts("  --bench-golden=dir  save frames rendered by --bench-render to dir");
+        puts("  --mirror-netlevels=dir  download all internet levels to dir and quit");
+        puts("  --bench-net=host:port   benchmark internet levels loading from a test");
+        puts("                      server (see httpd.c), write JSON results and quit");
         puts("");
         puts("Skin files can be are stored in a couple of different directories:");
         puts(" * a skins/ subdirectory in SimpleSok's application directory");
@@ -1412,9 +2633,14 @@ int main(int argc, char **argv) {
   struct spritesstruct *sprites;
   int levelscount, curlevel, exitflag = 0, showhelp = 0, lastlevelleft = 0;
   int playsolution, drawscreenflags;
+  int playedlevel = -1; /* last level played, its solution might need to be reloaded */
   char *levelfile = NULL;
   char *playsource = NULL;
+  struct playback *playback = NULL; /* keyframes of playsource, for seeking */
+  struct turbo turbo;
   char *levelslist = NULL;
+  char *benchfile = NULL, *goldendir = NULL, *mirrordir = NULL, *benchserver = NULL;
+  char *netlevelfile = NULL; /* internet level set streamed to disk */
   #define LEVCOMMENTMAXLEN 32
   char levcomment[LEVCOMMENTMAXLEN];
   struct videosettings settings;
@@ -1429,12 +2655,29 @@ int main(int argc, char **argv) {
   /* init (seed) the randomizer */
   srand((unsigned int)time(NULL));
 
-  exitflag = parse_cmdline(&settings, argc, argv, &levelfile);
+  exitflag = parse_cmdline(&settings, argc, argv, &levelfile, &benchfile, &goldendir, &mirrordir, &benchserver);
   if (exitflag != 0) return(1);
 
+  /* headless rendering benchmark: no window, no networking */
+  if (benchfile != NULL) {
+    return(bench_render(&settings, levelfile, benchfile, goldendir));
+  }
+
   /* init networking stack (required on windows) */
   init_net();
 
+  /* headless catalog mirroring and network benchmark: no window either */
+  if (mirrordir != NULL) {
+    exitflag = mirror_netlevels(mirrordir);
+    cleanup_net();
+    return(exitflag);
+  }
+  if (benchserver != NULL) {
+    exitflag = bench_net(benchserver);
+    cleanup_net();
+    return(exitflag);
+  }
+
   /* Init SDL and set the video mode */
   if (SDL_Init(SDL_INIT_VIDEO) != 0) {
     printf("SDL_Init() failed: %s\n", SDL_GetError());
@@ -1456,7 +2699,10 @@ int main(int argc, char **argv) {
   setsokicon(window);
   SDL_SetWindowMinimumSize(window, 160, 120);
 
-  renderer = SDL_CreateRenderer(window, -1, 0);
+  /* ask for a vsync'ed renderer so animations are paced by the display, and
+   * fall back to whatever is available if the driver refuses */
+  renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_PRESENTVSYNC);
+  if (renderer == NULL) renderer = SDL_CreateRenderer(window, -1, 0);
   if (renderer == NULL) {
     SDL_DestroyWindow(window);
     printf("Renderer could not be created! SDL_Error: %s\n", SDL_GetError());
@@ -1477,6 +2723,12 @@ int main(int argc, char **argv) {
   if ((settings.framedelay < 0) || (settings.framedelay > 64000)) settings.framedelay = 10500;
   if ((settings.framefreq < 1) || (settings.framefreq > 1000000)) settings.framefreq = 15000;
 
+  /* is the renderer synced to the display refresh? */
+  {
+    SDL_RendererInfo rinfo;
+    if ((SDL_GetRendererInfo(renderer, &rinfo) == 0) && (rinfo.flags & SDL_RENDERER_PRESENTVSYNC)) settings.vsync = 1;
+  }
+
   gameslist = malloc(sizeof(struct sokgame *) * MAXLEVELS);
   if (gameslist == NULL) {
     puts("Memory allocation failed!");
@@ -1492,29 +2744,32 @@ int main(int argc, char **argv) {
     levelslist = NULL;
   }
   curlevel = -1;
+  playedlevel = -1;
   levelscount = -1;
   settings.tilesize = auto_tilesize(sprites);
   if (levelfile != NULL) goto LoadLevelFile;
   xsblevelptr = selectgametype(renderer, sprites, window, &settings, &levelfile, &xsblevelptrlen);
   levelsource = LEVEL_INTERNAL;
   if ((xsblevelptr != NULL) && (*xsblevelptr == '@')) levelsource = LEVEL_INTERNET;
-  if (exitflag == 0) fade2texture(renderer, window, sprites->black);
+  if (exitflag == 0) fade2texture(renderer, window, sprites->black, &settings);
 
   LoadInternetLevels:
   if (levelsource == LEVEL_INTERNET) { /* internet levels */
     int selectres;
     size_t httpres;
-    httpres = http_get(INET_HOST, INET_PORT, INET_PATH, (unsigned char **) &levelslist);
-    if ((httpres == 0) || (levelslist == NULL)) {
+    free(levelslist); /* selectinternetlevel() altered it, and it might have changed anyway */
+    selectres = http_get_withprogress(renderer, window, sprites, &settings, "Fetching the list of internet levels", INET_HOST, INET_PORT, INET_PATH, (unsigned char **) &levelslist, &httpres);
+    if (selectres == SELECTLEVEL_BACK) goto GametypeSelectMenu;
+    if ((selectres == 0) && ((httpres == 0) || (levelslist == NULL))) {
       SDL_RenderClear(renderer);
       draw_string("Failed to fetch internet levels!", 100, 255, sprites, renderer, DRAWSTRING_CENTER, DRAWSTRING_CENTER, window, 1, 0);
       wait_for_a_key(-1, renderer);
       goto GametypeSelectMenu;
     }
-    selectres = selectinternetlevel(renderer, window, sprites, INET_HOST, INET_PORT, INET_PATH, levelslist, &xsblevelptr, &xsblevelptrlen);
+    if (selectres == 0) selectres = selectinternetlevel(renderer, window, sprites, &settings, INET_HOST, INET_PORT, INET_PATH, levelslist, &xsblevelptr, &xsblevelptrlen, &netlevelfile);
     if (selectres == SELECTLEVEL_BACK) goto GametypeSelectMenu;
     if (selectres == SELECTLEVEL_QUIT) exitflag = 1;
-    if (exitflag == 0) fade2texture(renderer, window, sprites->black);
+    if (exitflag == 0) fade2texture(renderer, window, sprites->black, &settings);
   } else if ((xsblevelptr == NULL) && (levelfile == NULL)) { /* nothing */
     exitflag = 1;
   }
@@ -1522,9 +2777,16 @@ int main(int argc, char **argv) {
   LoadLevelFile:
   if ((levelfile != NULL) && (exitflag == 0)) {
     levelscount = sok_loadfile(gameslist, MAXLEVELS, levelfile, NULL, 0, levcomment, LEVCOMMENTMAXLEN);
+  } else if ((netlevelfile != NULL) && (exitflag == 0)) {
+    levelscount = sok_loadfile(gameslist, MAXLEVELS, netlevelfile, NULL, 0, levcomment, LEVCOMMENTMAXLEN);
   } else if (exitflag == 0) {
     levelscount = sok_loadfile(gameslist, MAXLEVELS, NULL, xsblevelptr, xsblevelptrlen, levcomment, LEVCOMMENTMAXLEN);
   }
+  if (netlevelfile != NULL) { /* parsed, the file is not needed any more */
+    remove(netlevelfile);
+    free(netlevelfile);
+    netlevelfile = NULL;
+  }
 
   if ((levelscount < 1) && (exitflag == 0)) {
     SDL_RenderClear(renderer);
@@ -1541,7 +2803,8 @@ int main(int argc, char **argv) {
   if (exitflag == 0) exitflag = flush_events();
 
   if (exitflag == 0) {
-    curlevel = selectlevel(gameslist, sprites, renderer, window, &settings, levcomment, levelscount, curlevel, &levelfile);
+    curlevel = selectlevel(gameslist, sprites, renderer, window, &settings, levcomment, levelscount, curlevel, playedlevel, &levelfile);
+    playedlevel = -1;
     if (curlevel == SELECTLEVEL_BACK) {
       if (levelfile == NULL) {
         if (levelsource == LEVEL_INTERNET) goto LoadInternetLevels;
@@ -1555,8 +2818,11 @@ int main(int argc, char **argv) {
       goto GametypeSelectMenu;
     }
   }
-  if (exitflag == 0) fade2texture(renderer, window, sprites->black);
-  if (exitflag == 0) loadlevel(&game, gameslist[curlevel], states);
+  if (exitflag == 0) fade2texture(renderer, window, sprites->black, &settings);
+  if (exitflag == 0) {
+    loadlevel(&game, gameslist[curlevel], states);
+    playedlevel = curlevel;
+  }
 
   /* here we start the actual game */
 
@@ -1564,6 +2830,7 @@ int main(int argc, char **argv) {
   if ((curlevel == 0) && (game.solution == NULL)) showhelp = 1;
   playsolution = 0;
   drawscreenflags = 0;
+  memset(&turbo, 0, sizeof(turbo));
   if (exitflag == 0) lastlevelleft = islevelthelastleft(gameslist, curlevel, levelscount);
 
   while (exitflag == 0) {
@@ -1580,26 +2847,32 @@ int main(int argc, char **argv) {
     }
     if (debugmode != 0) printf("history: %s\n", states->history);
 
-    /* Wait for an event - but ignore 'KEYUP' and 'MOUSEMOTION' events, since they are worthless in this game */
-    for (;;) {
-      if (SDL_WaitEventTimeout(&event, 80) == 0) {
-        if (playsolution == 0) continue;
-        event.type = SDL_KEYDOWN;
-        event.key.keysym.sym = SDLK_F10;
+    /* Take the next queued input if any, otherwise wait for an event - but ignore 'KEYUP' and 'MOUSEMOTION' events, since they are worthless in this game */
+    if (inputqueue_pop(&event) == 0) {
+      for (;;) {
+        if (SDL_WaitEventTimeout(&event, ((playsolution > 0) && (settings.playspeed > 1)) ? 1 : 80) == 0) {
+          /* zoom has settled: rescale the sprite map so tiles are 1:1 copies */
+          gra_prescale(renderer, sprites, settings.tilesize);
+          if (playsolution == 0) continue;
+          event.type = SDL_KEYDOWN;
+          event.key.keysym.sym = SDLK_F10;
+        }
+        if ((event.type != SDL_KEYUP) && (event.type != SDL_MOUSEMOTION)) break;
       }
-      if ((event.type != SDL_KEYUP) && (event.type != SDL_MOUSEMOTION)) break;
     }
 
     /* check what event we got */
     if (event.type == SDL_QUIT) {
       exitflag = 1;
+    } else if ((event.type == SDL_RENDER_TARGETS_RESET) || (event.type == SDL_RENDER_DEVICE_RESET)) {
+      gra_flushcache(sprites); /* content of target textures is lost */
     } else if (event.type == SDL_DROPFILE) {
       if (processDropFileEvent(&event, &levelfile) != NULL) {
-        fade2texture(renderer, window, sprites->black);
+        fade2texture(renderer, window, sprites->black, &settings);
         goto GametypeSelectMenu;
       }
     } else if (event.type == SDL_KEYDOWN) {
-      int res = 0;
+      int res = 0, seek = -1, turbomode = ((playsolution > 0) && (settings.playspeed > 1));
       enum SOKMOVE movedir = sokmoveNONE;
       switch (normalizekeys(event.key.keysym.sym)) {
         case KEY_LEFT:
@@ -1623,6 +2896,9 @@ int main(int argc, char **argv) {
         case KEY_BACKSPACE:
           if (playsolution == 0) sok_undo(&game, states);
           break;
+        case KEY_CTRL_Y:
+          if (playsolution == 0) res = sok_redo(&game, states);
+          break;
         case KEY_R:
           playsolution = 0;
           loadlevel(&game, gameslist[curlevel], states);
@@ -1647,6 +2923,14 @@ int main(int argc, char **argv) {
             if (playsource != NULL) free(playsource);
             playsource = unRLE(solFromClipboard);
             free(solFromClipboard);
+            playback_free(playback);
+            playback = NULL;
+            if (playsource != NULL) {
+              playback = playback_new(&game, playsource);
+              turbo.start = 0;
+            } else {
+              playsolution = 0;
+            }
           } else {
             if (solFromClipboard != NULL) free(solFromClipboard);
           }
@@ -1660,6 +2944,9 @@ int main(int argc, char **argv) {
               if (playsource != NULL) {
                 loadlevel(&game, gameslist[curlevel], states);
                 playsolution = 1;
+                playback_free(playback);
+                playback = playback_new(&game, playsource);
+                turbo.start = 0;
               }
             } else {
               exitflag = displaytexture(renderer, sprites->nosolution, window, 1, DISPLAYCENTERED, 255);
@@ -1697,7 +2984,7 @@ int main(int argc, char **argv) {
             exitflag = displaytexture(renderer, sprites->loaded, window, 1, DISPLAYCENTERED, 255);
             playsolution = 0;
             loadlevel(&game, gameslist[curlevel], states);
-            sok_play(&game, states, loadsol);
+            sok_play_fast(&game, states, loadsol, strlen(loadsol));
             free(loadsol);
           }
           }
@@ -1705,97 +2992,131 @@ int main(int argc, char **argv) {
         case KEY_FULLSCREEN:
           switchfullscreen(window);
           break;
+        case KEY_F12:
+          settings.perfoverlay ^= 1;
+          break;
         case KEY_ESCAPE:
-          fade2texture(renderer, window, sprites->black);
+          fade2texture(renderer, window, sprites->black, &settings);
           goto LevelSelectMenu;
+        /* seeking within a playback, or through undo/redo otherwise: by 5%
+         * steps, or to the start or end */
+        case KEY_PAGEUP:
+        case KEY_PAGEDOWN:
+        case KEY_HOME:
+        case KEY_END:
+          if ((playsolution > 0) && (playback != NULL)) {
+            int pblen = (int)playback_len(playback), step = pblen / 20;
+            if (step < 10) step = 10;
+            seek = playsolution - 1;
+            if (normalizekeys(event.key.keysym.sym) == KEY_PAGEUP) seek -= step;
+            if (normalizekeys(event.key.keysym.sym) == KEY_PAGEDOWN) seek += step;
+            if (normalizekeys(event.key.keysym.sym) == KEY_HOME) seek = 0;
+            if (normalizekeys(event.key.keysym.sym) == KEY_END) seek = pblen;
+            /* the last move is always played for real, so solving the
+             * level is animated and celebrated as usual */
+            if (seek > pblen - 1) seek = pblen - 1;
+            if (seek < 0) seek = 0;
+            playsolution = (int)playback_seek(playback, &game, states, (size_t)seek) + 1;
+            turbo.start = 0;
+          } else if (playsolution == 0) {
+            size_t total = states->historylen + states->redolen, target = states->historylen, step = total / 20;
+            if (step < 10) step = 10;
+            if (normalizekeys(event.key.keysym.sym) == KEY_PAGEUP) target = (target > step) ? target - step : 0;
+            if (normalizekeys(event.key.keysym.sym) == KEY_PAGEDOWN) target += step;
+            if (normalizekeys(event.key.keysym.sym) == KEY_HOME) target = 0;
+            if (normalizekeys(event.key.keysym.sym) == KEY_END) target = total;
+            res = sok_jump(&game, states, target);
+          }
+          break;
+        /* playback speed: x1 is the animated playback, anything faster is
+         * turbo playback */
+        case KEY_PLUS:
+          if (settings.playspeed < PLAYSPEED_MAX) settings.playspeed *= 2;
+          turbo.start = 0;
+          break;
+        case KEY_MINUS:
+          if (settings.playspeed > 1) settings.playspeed /= 2;
+          turbo.start = 0;
+          break;
       }
-      if (playsolution > 0) {
+      if ((playsolution > 0) && (seek < 0) && (turbomode != 0)) {
+        /* turbo playback: apply all the moves due since the last frame at
+         * once, without any animation */
+        unsigned long due = turbo_due(&turbo, settings.playspeed);
+        size_t batch;
+        for (batch = 0; (batch < due) && (playsource[playsolution - 1 + batch] != 0); batch++);
+        res = sok_play_fast(&game, states, playsource + playsolution - 1, batch);
+        playsolution += (int)batch;
+        if ((res < 0) || (playsource[playsolution - 1] == 0)) playsolution = 0;
+        turbo_applied(&turbo, batch, &settings);
         movedir = sokmoveNONE;
-        switch (playsource[playsolution - 1]) {
-          case 'u':
-          case 'U':
-            movedir = sokmoveUP;
-            break;
-          case 'r':
-          case 'R':
-            movedir = sokmoveRIGHT;
-            break;
-          case 'd':
-          case 'D':
-            movedir = sokmoveDOWN;
-            break;
-          case 'l':
-          case 'L':
-            movedir = sokmoveLEFT;
-            break;
-        }
+        frame_wait(&settings); /* one frame per batch of moves */
+      }
+      if ((playsolution > 0) && (seek < 0) && (turbomode == 0)) {
+        movedir = playmovedir(playsource[playsolution - 1]);
         playsolution += 1;
         if (playsource[playsolution - 1] == 0) playsolution = 0;
       }
       if (movedir != sokmoveNONE) {
-        if (sprites->playerid == SPRITE_PLAYERROTATE) rotatePlayer(sprites, &game, states, movedir, renderer, window, &settings, levcomment, drawscreenflags);
+        if ((sprites->playerid == SPRITE_PLAYERROTATE) && (turbomode == 0)) rotatePlayer(sprites, &game, states, movedir, renderer, window, &settings, levcomment, drawscreenflags);
         res = sok_move(&game, movedir, 1, states);
-        if (res >= 0) { /* do animations */
+        if ((res >= 0) && (turbomode == 0)) { /* do animations */
           int offset, offsetx = 0, offsety = 0, scrolling;
-          int refreshnow = 1;
+          struct animation anim;
           if (res & sokmove_pushed) drawscreenflags |= DRAWSCREEN_PUSH;
           /* How will I need to move? */
           if (movedir == sokmoveUP) offsety = -1;
           if (movedir == sokmoveRIGHT) offsetx = 1;
           if (movedir == sokmoveDOWN) offsety = 1;
           if (movedir == sokmoveLEFT) offsetx = -1;
-          sokDelay(0 - settings.framefreq);  /* init my delay timer */
-          /* Will I need to move the player, or the entire field? */
-          for (offset = 0; offset != settings.tilesize * offsetx; offset += offsetx) {
-            if (refreshnow) {
-              scrolling = scrollneeded(&game, window, settings.tilesize, offsetx, offsety);
-              draw_screen(&game, states, sprites, renderer, window, &settings, offset, 0, scrolling, DRAWSCREEN_REFRESH | drawscreenflags, levcomment);
-            }
-            refreshnow = sokDelay((settings.framedelay * 12) / settings.tilesize); /* wait a moment and check if it's time to refresh */
-          }
-          for (offset = 0; offset != settings.tilesize * offsety; offset += offsety) {
-            if (refreshnow) {
-              scrolling = scrollneeded(&game, window, settings.tilesize, offsetx, offsety);
-              draw_screen(&game, states, sprites, renderer, window, &settings, 0, offset, scrolling, DRAWSCREEN_REFRESH | drawscreenflags, levcomment);
-            }
-            refreshnow = sokDelay((settings.framedelay * 12) / settings.tilesize); /* wait a moment and check if it's time to refresh */
+          /* a move lasts (framedelay * 12) us whatever the zoom, the offset is interpolated for every displayed frame */
+          anim_start(&anim, settings.framedelay * 12L);
+          scrolling = scrollneeded(&game, window, settings.tilesize, offsetx, offsety);
+          for (;;) {
+            int progress;
+            if (anim_coalesce(&anim, settings.framedelay * 12L) != 0) break;
+            progress = anim_progress(&anim);
+            if (progress >= ANIM_DONE) break;
+            offset = settings.tilesize * progress / ANIM_DONE;
+            draw_screen(&game, states, sprites, renderer, window, &settings, offset * offsetx, offset * offsety, scrolling, DRAWSCREEN_REFRESH | drawscreenflags, levcomment);
+            frame_wait(&settings);
           }
         }
         res = sok_move(&game, movedir, 0, states);
-        if ((res >= 0) && (res & sokmove_solved)) {
-          unsigned short alphaval;
-          SDL_Texture *tmptex;
-          /* display a congrats message */
+      }
+      if ((res >= 0) && (res & sokmove_solved)) {
+        unsigned short alphaval;
+        SDL_Texture *tmptex;
+        /* display a congrats message */
+        if (lastlevelleft != 0) {
+          tmptex = sprites->congrats;
+        } else {
+          tmptex = sprites->cleared;
+        }
+        flush_events();
+        for (alphaval = 0; alphaval < 255; alphaval += 30) {
+          draw_screen(&game, states, sprites, renderer, window, &settings, 0, 0, 0, drawscreenflags, levcomment);
+          exitflag = displaytexture(renderer, tmptex, window, 0, DISPLAYCENTERED, (unsigned char)alphaval);
+          SDL_Delay(25);
+          if (exitflag != 0) break;
+        }
+        if (exitflag == 0) {
+          draw_screen(&game, states, sprites, renderer, window, &settings, 0, 0, 0, drawscreenflags, levcomment);
+          /* if this was the last level left, display a congrats screen */
           if (lastlevelleft != 0) {
-            tmptex = sprites->congrats;
+            exitflag = displaytexture(renderer, sprites->congrats, window, 10, DISPLAYCENTERED, 255);
           } else {
-            tmptex = sprites->cleared;
-          }
-          flush_events();
-          for (alphaval = 0; alphaval < 255; alphaval += 30) {
-            draw_screen(&game, states, sprites, renderer, window, &settings, 0, 0, 0, drawscreenflags, levcomment);
-            exitflag = displaytexture(renderer, tmptex, window, 0, DISPLAYCENTERED, (unsigned char)alphaval);
-            SDL_Delay(25);
-            if (exitflag != 0) break;
+            exitflag = displaytexture(renderer, sprites->cleared, window, 3, DISPLAYCENTERED, 255);
           }
+          /* fade out to black */
           if (exitflag == 0) {
-            draw_screen(&game, states, sprites, renderer, window, &settings, 0, 0, 0, drawscreenflags, levcomment);
-            /* if this was the last level left, display a congrats screen */
-            if (lastlevelleft != 0) {
-              exitflag = displaytexture(renderer, sprites->congrats, window, 10, DISPLAYCENTERED, 255);
-            } else {
-              exitflag = displaytexture(renderer, sprites->cleared, window, 3, DISPLAYCENTERED, 255);
-            }
-            /* fade out to black */
-            if (exitflag == 0) {
-              fade2texture(renderer, window, sprites->black);
-              exitflag = flush_events();
-            }
+            fade2texture(renderer, window, sprites->black, &settings);
+            exitflag = flush_events();
           }
-          /* load the new level and reset states */
-          curlevel = -1; /* this will make the selectlevel() function to preselect the next level automatically */
-          goto LevelSelectMenu;
         }
+        /* load the new level and reset states */
+        curlevel = -1; /* this will make the selectlevel() function to preselect the next level automatically */
+        goto LevelSelectMenu;
       }
       drawscreenflags &= ~DRAWSCREEN_PUSH;
     }
@@ -1805,10 +3126,12 @@ int main(int argc, char **argv) {
 
   /* free the states struct */
   sok_freestates(states);
+  playback_free(playback);
 
   if (levelfile != NULL) free(levelfile);
 
   /* free all textures */
+  thumbcache_flush();
   skin_free(sprites);
 
   /* clean up SDL */
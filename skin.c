@@ -37,12 +37,10 @@
 #include "skin.h"
 
 
-/* loads a bmp.gz graphic and returns it as a texture, NULL on error */
-static SDL_Texture *loadGraphic(SDL_Renderer *renderer, const void *memptr, size_t memlen) {
-  SDL_Surface *surface;
+/* uploads surface to a texture and frees the surface. returns NULL on error */
+static SDL_Texture *surface2texture(SDL_Renderer *renderer, SDL_Surface *surface) {
   SDL_Texture *texture;
 
-  surface = loadgzbmp(memptr, memlen);
   if (surface == NULL) {
     puts("loadgzbmp() failed!");
     return(NULL);
@@ -60,6 +58,69 @@ static SDL_Texture *loadGraphic(SDL_Renderer *renderer, const void *memptr, size
 }
 
 
+/* loads a bmp.gz graphic and returns it as a texture, NULL on error */
+static SDL_Texture *loadGraphic(SDL_Renderer *renderer, const void *memptr, size_t memlen) {
+  return(surface2texture(renderer, loadgzbmp(memptr, memlen)));
+}
+
+
+/* scans the pixels of every tile of a sprite map surface (before it is
+ * uploaded) and records in spr which tiles are empty or opaque, and the
+ * bounding box of their visible pixels */
+static void analyze_spritemap(struct spritesstruct *spr, SDL_Surface *surface) {
+  SDL_Surface *argb;
+  const Uint32 *pixels;
+  int id, x, y, rows;
+
+  spr->tilescount = 0;
+  if ((surface == NULL) || (spr->tilesize == 0)) return;
+  argb = SDL_ConvertSurfaceFormat(surface, SDL_PIXELFORMAT_ARGB8888, 0);
+  if (argb == NULL) return;
+  if (SDL_LockSurface(argb) != 0) {
+    SDL_FreeSurface(argb);
+    return;
+  }
+
+  rows = (argb->h - 1) / (spr->tilesize + 1);
+  if (rows * 8 > SPRITES_MAX) rows = SPRITES_MAX / 8;
+  for (id = 0; id < rows * 8; id++) {
+    struct spriteinfo *info = &(spr->tileinfo[id]);
+    int tilex = 1 + (id % 8) * (spr->tilesize + 1);
+    int tiley = 1 + (id / 8) * (spr->tilesize + 1);
+    int minx = spr->tilesize, miny = spr->tilesize, maxx = -1, maxy = -1;
+    info->opaque = 1;
+    for (y = 0; y < spr->tilesize; y++) {
+      pixels = (const Uint32 *)((const Uint8 *)argb->pixels + (tiley + y) * argb->pitch) + tilex;
+      for (x = 0; x < spr->tilesize; x++) {
+        Uint32 alpha = pixels[x] >> 24;
+        if (alpha != 0xff) info->opaque = 0;
+        if (alpha == 0) continue;
+        if (x < minx) minx = x;
+        if (x > maxx) maxx = x;
+        if (y < miny) miny = y;
+        if (y > maxy) maxy = y;
+      }
+    }
+    info->empty = (maxx < 0) ? 1 : 0;
+    if (info->empty != 0) {
+      info->bbox.x = 0;
+      info->bbox.y = 0;
+      info->bbox.w = 0;
+      info->bbox.h = 0;
+    } else {
+      info->bbox.x = minx;
+      info->bbox.y = miny;
+      info->bbox.w = maxx - minx + 1;
+      info->bbox.h = maxy - miny + 1;
+    }
+  }
+  spr->tilescount = (unsigned short)(rows * 8);
+
+  SDL_UnlockSurface(argb);
+  SDL_FreeSurface(argb);
+}
+
+
 /* looks out for a skin file and opens it, if found */
 static FILE *skin_lookup(const char *name) {
   FILE *fd = NULL;
@@ -178,7 +239,7 @@ struct spritesstruct *skin_load(const char *name, SDL_Renderer *renderer) {
   struct spritesstruct *sprites;
   int i;
   FILE *fd;
-  int gwidth;
+  SDL_Surface *mapsurface;
 
   sprites = calloc(sizeof(struct spritesstruct), 1);
   if (sprites == NULL) {
@@ -193,15 +254,19 @@ struct spritesstruct *skin_load(const char *name, SDL_Renderer *renderer) {
     memptr = malloc(1024 * 1024);
     skinlen = fread(memptr, 1, 1024 * 1024, fd);
     fclose(fd);
-    sprites->map = loadGraphic(renderer, memptr, skinlen);
+    mapsurface = loadgzbmp(memptr, skinlen);
     free(memptr);
   } else { /* otherwise load the embedded skin */
     fprintf(stderr, "skin load failed ('%s'), falling back to embedded default\n", name);
-    sprites->map = loadGraphic(renderer, skins_yoshi_bmp_gz, skins_yoshi_bmp_gz_len);
+    mapsurface = loadgzbmp(skins_yoshi_bmp_gz, skins_yoshi_bmp_gz_len);
   }
   /* a sprite map is 8 tiles wide with each tile having a 1px margin */
-  SDL_QueryTexture(sprites->map, NULL, NULL, &gwidth, NULL);
-  sprites->tilesize = (unsigned short)(gwidth - 9) / 8; /* 8 tiles, 9 pixels of total margins per line */
+  if (mapsurface != NULL) {
+    sprites->tilesize = (unsigned short)(mapsurface->w - 9) / 8; /* 8 tiles, 9 pixels of total margins per line */
+    /* look at tile pixels while they are still in RAM */
+    analyze_spritemap(sprites, mapsurface);
+  }
+  sprites->map = surface2texture(renderer, mapsurface);
 
   /* playfield items */
   sprites->black = loadGraphic(renderer, assets_img_black_bmp_gz, assets_img_black_bmp_gz_len);
@@ -307,35 +372,10 @@ struct spritesstruct *skin_load(const char *name, SDL_Renderer *renderer) {
     if (sprites->font[i] == NULL) sprites->font[i] = sprites->font['_'];
   }
 
-  /* analyze the PLAYERROTATE position - if completely transparent, then player character is static */
+  /* if the PLAYERROTATE position is completely transparent, then player character is static */
   sprites->playerid = SPRITE_PLAYERSTATIC;
-  {
-    SDL_Rect r;
-    uint32_t *pixels;
-
-    pixels = malloc(sprites->tilesize * sprites->tilesize * 4);
-
-    r.x = 0;
-    r.y = 0;
-    r.w = sprites->tilesize;
-    r.h = sprites->tilesize;
-
-    /* clear the entire screen to bright pink so I can easily determine if player's rotate sprite is empty or not */
-    SDL_SetRenderDrawColor(renderer, 255, 0, 255, 255);
-    SDL_RenderClear(renderer);
-    SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255); /* restore current color to black */
-
-    gra_rendertile(renderer, sprites, SPRITE_PLAYERROTATE, 0, 0, sprites->tilesize, 0);
-    if (SDL_RenderReadPixels(renderer, &r, SDL_PIXELFORMAT_RGBA8888, pixels, sprites->tilesize * 4) != 0) {
-      printf("OOOPS: %s\n", SDL_GetError());
-    }
-    for (i = 0; i < sprites->tilesize * sprites->tilesize; i++) {
-      if (pixels[i] != 0xff00ffff) {
-        sprites->playerid = SPRITE_PLAYERROTATE;
-        break;
-      }
-    }
-    free(pixels);
+  if ((SPRITE_PLAYERROTATE < sprites->tilescount) && (sprites->tileinfo[SPRITE_PLAYERROTATE].empty == 0)) {
+    sprites->playerid = SPRITE_PLAYERROTATE;
   }
 
   /* compute the em unit used to scale other things in the game */
@@ -352,6 +392,7 @@ struct spritesstruct *skin_load(const char *name, SDL_Renderer *renderer) {
 
 void skin_free(struct spritesstruct *sprites) {
   int x;
+  gra_flushcache(sprites);
   if (sprites->map) SDL_DestroyTexture(sprites->map);
   if (sprites->black) SDL_DestroyTexture(sprites->black);
   if (sprites->nosolution) SDL_DestroyTexture(sprites->nosolution);
@@ -148,6 +148,69 @@ static int readRLEbyte(unsigned char **memptr, int *bytebuff) {
   return(rleprefix);
 }
 
+#define ZOBRIST_BOX 0
+#define ZOBRIST_PLAYER 1
+
+/* returns the zobrist key of a box or of a player area at x,y. keys are
+ * derived from the cell by a splitmix64 step, so no table has to be set up */
+static unsigned long long zobristkey(int kind, int x, int y) {
+  unsigned long long z = ((unsigned long long)((kind << 12) | (y << 6) | x) + 1) * 0x9E3779B97F4A7C15ULL;
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+  return(z ^ (z >> 31));
+}
+
+/* returns the top-left-most cell (y * 64 + x) the player can walk to
+ * without pushing anything. positions that differ only by where the player
+ * stands within that area are the same position */
+static int findplayerarea(const struct sokgame *game) {
+  static const int stepx[4] = {1, -1, 0, 0};
+  static const int stepy[4] = {0, 0, 1, -1};
+  unsigned char seen[64][64];
+  unsigned short stack[64 * 64];
+  int stacklen = 0, x, y, best;
+  memset(seen, 0, sizeof(seen));
+  best = game->positiony * 64 + game->positionx;
+  seen[game->positionx][game->positiony] = 1;
+  stack[stacklen++] = (unsigned short)best;
+  while (stacklen > 0) {
+    int cell = stack[--stacklen], i;
+    if (cell < best) best = cell;
+    for (i = 0; i < 4; i++) {
+      x = (cell & 63) + stepx[i];
+      y = (cell >> 6) + stepy[i];
+      if ((x < 0) || (x > 63) || (y < 0) || (y > 63)) continue;
+      if (seen[x][y] != 0) continue;
+      if (game->field[x][y] & (field_wall | field_atom)) continue;
+      seen[x][y] = 1;
+      stack[stacklen++] = (unsigned short)(y * 64 + x);
+    }
+  }
+  return(best);
+}
+
+/* refreshes the player area part of the hash, after a push */
+static void rehashplayer(struct sokgame *game) {
+  int area = findplayerarea(game);
+  if (area == game->playerarea) return;
+  game->zobrist ^= zobristkey(ZOBRIST_PLAYER, game->playerarea & 63, game->playerarea >> 6);
+  game->zobrist ^= zobristkey(ZOBRIST_PLAYER, area & 63, area >> 6);
+  game->playerarea = area;
+}
+
+void sok_rehash(struct sokgame *game) {
+  int x, y;
+  game->zobrist = 0;
+  for (y = 0; y < 64; y++) {
+    for (x = 0; x < 64; x++) {
+      if (game->field[x][y] & field_atom) game->zobrist ^= zobristkey(ZOBRIST_BOX, x, y);
+    }
+  }
+  game->playerarea = findplayerarea(game);
+  game->zobrist ^= zobristkey(ZOBRIST_PLAYER, game->playerarea & 63, game->playerarea >> 6);
+}
+
+
 /* floodfill algorithm to fill areas of a playfield that are not contained in walls */
 static void floodFillField(struct sokgame *game, int x, int y) {
   if ((x >= 0) && (x < 64) && (y >= 0) && (y < 64) && (game->field[x][y] == field_floor)) {
@@ -290,6 +353,7 @@ static int loadlevelfromfile(struct sokgame *game, unsigned char **memptr, char
     }
   }
   crc32_finish(&(game->crc32));
+  sok_rehash(game);
 
   if (endoffile != 0) return(1);
   return(0);
@@ -389,11 +453,17 @@ int sok_loadfile(struct sokgame **gamelist, int maxlevels, char *gamelevel, unsi
   return(level);
 }
 
+/* reloads the solution of a single level */
+void sok_reloadsolution(struct sokgame *game) {
+  if (game->solution != NULL) free(game->solution);
+  game->solution = solution_load(game->crc32, "dat");
+}
+
 /* reloads solutions for all levels in a list */
 void sok_loadsolutions(struct sokgame **gamelist, int levelscount) {
   int x = 0;
   for (x = 0; x < levelscount; x++) {
-    gamelist[x]->solution = solution_load(gamelist[x]->crc32, "dat");
+    sok_reloadsolution(gamelist[x]);
   }
 }
 
@@ -411,8 +481,8 @@ int sok_checksolution(struct sokgame *game, struct sokgamestates *states) {
   /* Check if the solution is better than the one we had so far */
   bestscorelen = sok_history_getlen(game->solution);
   bestscorepushes = sok_history_getpushes(game->solution);
-  myscorelen = sok_history_getlen(states->history);
-  myscorepushes = sok_history_getpushes(states->history);
+  myscorelen = states->historylen;
+  myscorepushes = states->pushes;
   if (bestscorelen < 1) betterflag = 1;
   if (bestscorelen > myscorelen) betterflag = 1;
   if ((bestscorelen == myscorelen) && (bestscorepushes > myscorepushes)) betterflag = 1;
@@ -427,7 +497,7 @@ int sok_move(struct sokgame *game, enum SOKMOVE dir, int validitycheck, struct s
   int x, y, vectorx = 0, vectory = 0, alreadysolved;
   char historychar = ' ';
   size_t movescount;
-  movescount = sok_history_getlen(states->history);
+  movescount = states->historylen;
   /* first of all let's check if we have enough place in history for a potential move - if not, realloc some place */
   if (movescount + 3 >= states->historyallocsize) {
     states->historyallocsize *= 2;
@@ -483,8 +553,21 @@ int sok_move(struct sokgame *game, enum SOKMOVE dir, int validitycheck, struct s
   if (validitycheck == 0) {
     states->history[movescount] = historychar;
     states->history[movescount + 1] = 0; /* makes it a null-terminated string in case anyone would want to print it as-is */
+    states->historylen = movescount + 1;
+    if (res & sokmove_pushed) states->pushes += 1;
+    /* playing the move that would be redone next keeps the redo stack, any other move discards it */
+    if ((states->redolen > 0) && (states->redo[states->redolen - 1] == historychar)) {
+      states->redolen -= 1;
+    } else {
+      states->redolen = 0;
+    }
     game->positiony += vectory;
     game->positionx += vectorx;
+    /* a walk leaves the position as it is, a push moves a box and may change the player's area */
+    if (res & sokmove_pushed) {
+      game->zobrist ^= zobristkey(ZOBRIST_BOX, x + vectorx, y + vectory) ^ zobristkey(ZOBRIST_BOX, x + vectorx * 2, y + vectory * 2);
+      rehashplayer(game);
+    }
   }
   if ((alreadysolved == 0) && (sok_checksolution(game, states) != 0)) res |= sokmove_solved;
   return(res);
@@ -492,6 +575,7 @@ int sok_move(struct sokgame *game, enum SOKMOVE dir, int validitycheck, struct s
 
 void sok_resetstates(struct sokgamestates *states) {
   if (states->history != NULL) free(states->history);
+  if (states->redo != NULL) free(states->redo);
   memset(states, 0, sizeof(struct sokgamestates));
   states->historyallocsize = 64;
   states->history = malloc(states->historyallocsize);
@@ -510,15 +594,28 @@ struct sokgamestates *sok_newstates(void) {
 void sok_freestates(struct sokgamestates *states) {
   if (states == NULL) return;
   if (states->history != NULL) free(states->history);
+  if (states->redo != NULL) free(states->redo);
   free(states);
 }
 
 void sok_undo(struct sokgame *game, struct sokgamestates *states) {
   int movex = 0, movey = 0;
   size_t movescount;
-  movescount = sok_history_getlen(states->history);
+  movescount = states->historylen;
   if (movescount < 1) return;
   movescount -= 1;
+  /* keep the move on the redo stack */
+  if (states->redolen + 1 > states->redoallocsize) {
+    size_t newsize = (states->redoallocsize > 0) ? states->redoallocsize * 2 : 64;
+    char *newredo = realloc(states->redo, newsize);
+    if (newredo != NULL) {
+      states->redo = newredo;
+      states->redoallocsize = newsize;
+    } else {
+      states->redolen = 0; /* redo lost, but undo still works */
+    }
+  }
+  if (states->redolen < states->redoallocsize) states->redo[states->redolen++] = states->history[movescount];
   switch (states->history[movescount]) {
     case 'u':
     case 'U':
@@ -545,10 +642,49 @@ void sok_undo(struct sokgame *game, struct sokgamestates *states) {
   if ((states->history[movescount] >= 'A') && ((states->history[movescount] <= 'Z'))) {
     game->field[game->positionx - movex][game->positiony - movey] &= ~field_atom;
     game->field[game->positionx][game->positiony] |= field_atom;
+    game->zobrist ^= zobristkey(ZOBRIST_BOX, game->positionx - movex, game->positiony - movey) ^ zobristkey(ZOBRIST_BOX, game->positionx, game->positiony);
+    states->pushes -= 1;
   }
   game->positionx += movex;
   game->positiony += movey;
+  if ((states->history[movescount] >= 'A') && ((states->history[movescount] <= 'Z'))) rehashplayer(game);
   states->history[movescount] = 0;
+  states->historylen = movescount;
+}
+
+int sok_redo(struct sokgame *game, struct sokgamestates *states) {
+  enum SOKMOVE dir;
+  if (states->redolen < 1) return(-1);
+  switch (states->redo[states->redolen - 1]) {
+    case 'u':
+    case 'U':
+      dir = sokmoveUP;
+      break;
+    case 'r':
+    case 'R':
+      dir = sokmoveRIGHT;
+      break;
+    case 'd':
+    case 'D':
+      dir = sokmoveDOWN;
+      break;
+    default:
+      dir = sokmoveLEFT;
+      break;
+  }
+  /* sok_move() pops the redo stack, since this is the move it expects */
+  return(sok_move(game, dir, 0, states));
+}
+
+int sok_jump(struct sokgame *game, struct sokgamestates *states, size_t target) {
+  int res = 0, moveres;
+  while (states->historylen > target) sok_undo(game, states);
+  while ((states->historylen < target) && (states->redolen > 0)) {
+    moveres = sok_redo(game, states);
+    if (moveres < 0) break;
+    res |= moveres;
+  }
+  return(res);
 }
 
 void sok_play(struct sokgame *game, struct sokgamestates *states, char *playfile) {
@@ -580,3 +716,135 @@ void sok_play(struct sokgame *game, struct sokgamestates *states, char *playfile
     playfile += 1;
   }
 }
+
+int sok_play_fast(struct sokgame *game, struct sokgamestates *states, const char *moves, size_t len) {
+  size_t i, movescount, pushes = 0, solvedat = 0, solvedpushes = 0;
+  int x, y, vectorx, vectory, lastmove = -1, goalsleft = 0, res = 0;
+  char *history;
+  char solvedchar;
+  /* validate the whole string first, so nothing is played if it is not legal */
+  for (i = 0; i < len; i++) {
+    switch (moves[i]) {
+      case 'u':
+      case 'U':
+      case 'r':
+      case 'R':
+      case 'd':
+      case 'D':
+      case 'l':
+      case 'L':
+        break;
+      default:
+        return(ERR_UNDEFINED);
+    }
+  }
+  /* make room in history for all the moves at once */
+  movescount = states->historylen;
+  if (movescount + len + 3 >= states->historyallocsize) {
+    size_t newsize = states->historyallocsize;
+    while (movescount + len + 3 >= newsize) newsize *= 2;
+    history = realloc(states->history, newsize);
+    if (history == NULL) {
+      printf("failed to allocate %lu bytes for history buffer!\n", (unsigned long)newsize);
+      return(ERR_MEM_ALLOC_FAILED);
+    }
+    states->history = history;
+    states->historyallocsize = newsize;
+  }
+  /* count empty goals, so the solved state is known at every push without
+   * scanning the whole field. boxes cannot be pushed once it is solved,
+   * just like with sok_move() */
+  for (y = 0; y < game->field_height; y++) {
+    for (x = 0; x < game->field_width; x++) {
+      if ((game->field[x][y] & (field_goal | field_atom)) == field_goal) goalsleft += 1;
+    }
+  }
+  if (goalsleft == 0) solvedat = (size_t)-1; /* already solved before we started */
+  history = states->history + movescount;
+  for (i = 0; i < len; i++) {
+    vectorx = 0;
+    vectory = 0;
+    switch (moves[i]) {
+      case 'u':
+      case 'U':
+        vectory = -1;
+        lastmove = 'u';
+        break;
+      case 'r':
+      case 'R':
+        vectorx = 1;
+        lastmove = 'r';
+        break;
+      case 'd':
+      case 'D':
+        vectory = 1;
+        lastmove = 'd';
+        break;
+      default: /* 'l' or 'L', the string has been validated */
+        vectorx = -1;
+        lastmove = 'l';
+        break;
+    }
+    x = game->positionx + vectorx;
+    y = game->positiony + vectory;
+    if (game->positiony < 1) continue;
+    if (game->field[x][y] & field_wall) continue;
+    if (game->field[x][y] & field_atom) {
+      if (goalsleft == 0) continue;
+      if ((y < 1) || (y > 62) || (x < 1) || (x > 62)) continue;
+      if (game->field[x + vectorx][y + vectory] & (field_wall | field_atom)) continue;
+      game->field[x][y] &= ~field_atom;
+      game->field[x + vectorx][y + vectory] |= field_atom;
+      game->zobrist ^= zobristkey(ZOBRIST_BOX, x, y) ^ zobristkey(ZOBRIST_BOX, x + vectorx, y + vectory);
+      if (game->field[x][y] & field_goal) goalsleft += 1;
+      if (game->field[x + vectorx][y + vectory] & field_goal) goalsleft -= 1;
+      *(history++) = (char)(lastmove - 32); /* uppercase marks a push */
+      pushes += 1;
+      if (goalsleft == 0) {
+        solvedat = (size_t)(history - states->history);
+        solvedpushes = pushes;
+      }
+    } else {
+      *(history++) = (char)lastmove;
+    }
+    /* like with sok_move(), playing the move that would be redone next keeps the redo stack */
+    if ((states->redolen > 0) && (states->redo[states->redolen - 1] == history[-1])) {
+      states->redolen -= 1;
+    } else {
+      states->redolen = 0;
+    }
+    game->positionx = x;
+    game->positiony = y;
+  }
+  *history = 0;
+  if (pushes > 0) rehashplayer(game); /* the player's area only matters once all moves are done */
+  switch (lastmove) {
+    case 'u':
+      states->angle = 0;
+      break;
+    case 'r':
+      states->angle = 90;
+      break;
+    case 'd':
+      states->angle = 180;
+      break;
+    case 'l':
+      states->angle = 270;
+      break;
+  }
+  /* the level got solved: let sok_checksolution() save the solution, as it
+   * was when the last box reached its goal */
+  if ((solvedat > 0) && (solvedat != (size_t)-1)) {
+    solvedchar = states->history[solvedat];
+    states->history[solvedat] = 0;
+    states->historylen = solvedat;
+    states->pushes += solvedpushes;
+    sok_checksolution(game, states);
+    states->pushes -= solvedpushes;
+    states->history[solvedat] = solvedchar;
+    res |= sokmove_solved;
+  }
+  states->historylen = (size_t)(history - states->history);
+  states->pushes += pushes;
+  return(res);
+}
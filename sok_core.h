@@ -41,12 +41,19 @@
     unsigned short level;
     unsigned long crc32;
     char *solution;
+    unsigned long long zobrist; /* hash of the position: boxes and the area the player can reach */
+    int playerarea;             /* top-left-most cell (y * 64 + x) of the area the player can reach */
   };
 
   struct sokgamestates {
     int angle;
     char *history;
     size_t historyallocsize;
+    size_t historylen;     /* moves in history, kept up to date so no strlen() is needed */
+    size_t pushes;         /* pushes in history */
+    char *redo;            /* undone moves, the next one to redo being the last */
+    size_t redolen;
+    size_t redoallocsize;
   };
 
   enum SOKMOVE {
@@ -72,9 +79,18 @@
   /* try to move the player in a direction. returns a negative value if move has been denied, or a sokmove bitfield otherwise. */
   int sok_move(struct sokgame *game, enum SOKMOVE dir, int validitycheck, struct sokgamestates *states);
 
-  /* undo last move */
+  /* undo last move. the move is kept for sok_redo() until another move is played */
   void sok_undo(struct sokgame *game, struct sokgamestates *states);
 
+  /* replays the last undone move. returns a negative value if there is
+   * nothing to redo, or a sokmove bitfield otherwise. */
+  int sok_redo(struct sokgame *game, struct sokgamestates *states);
+
+  /* undoes or redoes moves until history holds target moves (at most the
+   * moves in history plus those that can be redone). returns a sokmove
+   * bitfield, with sokmove_solved if a redone move solved the level. */
+  int sok_jump(struct sokgame *game, struct sokgamestates *states, size_t target);
+
   /* returns the number of moves in a history string */
   size_t sok_history_getlen(const char *history);
 
@@ -90,13 +106,28 @@
   /* free the memory occupied by a previously allocated states structure */
   void sok_freestates(struct sokgamestates *states);
 
+  /* reloads the solution of a single level (frees the previous one, if any) */
+  void sok_reloadsolution(struct sokgame *game);
+
   /* reloads solutions for all levels in a list */
   void sok_loadsolutions(struct sokgame **gamelist, int levelscount);
 
+  /* computes the position hash of a game (zobrist and playerarea) from scratch.
+   * sok_move(), sok_undo() and sok_play_fast() keep it up to date, this is
+   * only needed after changing the field by other means. */
+  void sok_rehash(struct sokgame *game);
+
   /* returns a human string for error code */
   char *sok_strerr(int errid);
 
   /* plays a string of moves */
   void sok_play(struct sokgame *game, struct sokgamestates *states, char *playfile);
 
+  /* plays the first len moves of a LURD string in one go, with the same rules
+   * as sok_move(). the string is validated first and nothing is played if it
+   * contains anything else than LURD moves. returns a negative value on
+   * error, a sokmove bitfield otherwise (sokmove_solved if the level got
+   * solved on the way). */
+  int sok_play_fast(struct sokgame *game, struct sokgamestates *states, const char *moves, size_t len);
+
 #endif